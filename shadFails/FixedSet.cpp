@@ -3,6 +3,37 @@
 #include <cassert>
 #include <cmath>
 #include <random>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <span>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <type_traits>
+#include <coroutine>
+#include <utility>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <concepts>
+#include <limits>
+#include <charconv>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <immintrin.h>
 
 template<typename T>
 class Optional {
@@ -18,233 +49,4460 @@ private:
     T value_;
 };
 
-std::vector<int> ReadVector(std::istream &in);
+// Slot storage policies of the second-level tables. A policy is filled
+// through Reset/Assign, then sealed once, and after that only
+// Prefetch and Matches are used.
+
+// The Seal of the filler policies: copies, in each of slots, the entry of
+// the first occupied position over every position that is not occupied.
+// Empty vectors are skipped. Does nothing if no position is occupied.
+template<typename... Vectors>
+void FillEmptySlots(const std::vector<bool> &occupied, Vectors &...slots);
+
+// One Optional<T> per slot: the flag doubles the slot size for int keys.
+template<typename T>
+class OptionalSlots {
+public:
+    void Reset(size_t size);
+
+    void Assign(size_t position, const T &value);
+
+    void Seal() {}
+
+    void Prefetch(size_t position) const;
+
+    bool Matches(size_t position, const T &value) const;
+
+private:
+    std::vector<Optional<T>> slots_;
+};
+
+// Bare keys, empty slots hold a copy of some stored key. Any key found in
+// a slot belongs to the set, so a filler can never produce a false
+// positive, and no key value has to be reserved as a sentinel.
+template<typename T>
+class FillerSlots {
+public:
+    FillerSlots() = default;
+
+    FillerSlots(FillerSlots &&other) = default;
+
+    FillerSlots &operator=(FillerSlots &&other) = default;
+
+    void Reset(size_t size);
+
+    void Assign(size_t position, const T &value);
+
+    void Seal();
+
+    // Serves lookups from keys owned elsewhere, e.g. by a file mapping,
+    // which must outlive the slots.
+    void Attach(std::span<const T> keys);
+
+    void Prefetch(size_t position) const;
+
+    bool Matches(size_t position, const T &value) const;
+
+    const T *Data() const;
+
+    size_t Size() const;
+
+private:
+    std::vector<T> keys_;
+    std::vector<bool> occupied_;
+    const T *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Dense keys plus a packed occupancy bitmap beside them.
+template<typename T>
+class BitmapSlots {
+public:
+    void Reset(size_t size);
+
+    void Assign(size_t position, const T &value);
+
+    void Seal() {}
+
+    void Prefetch(size_t position) const;
+
+    bool Matches(size_t position, const T &value) const;
+
+private:
+    bool IsOccupied(size_t position) const;
+
+    std::vector<T> keys_;
+    std::vector<uint64_t> occupancy_;
+};
+
+// Slots for std::string_view keys. Assign copies the string into one
+// arena, and a slot is the offset and length of its copy, so the keys
+// passed to Initialize need not outlive the set, and the strings sit
+// together instead of in one heap block each. Empty slots repeat a stored
+// slot, as in FillerSlots.
+class ArenaSlots {
+public:
+    // Bounds of a slot: the length of a key and the size of the arena.
+    static constexpr size_t kMaxLength = (size_t(1) << 24) - 1;
+    static constexpr uint64_t kMaxArenaSize = uint64_t(1) << 40;
+
+    void Reset(size_t size);
+
+    void Assign(size_t position, std::string_view value);
+
+    void Seal();
+
+    void Prefetch(size_t position) const;
+
+    bool Matches(size_t position, std::string_view value) const;
+
+private:
+    // One word: a 40-bit arena offset and a 24-bit length.
+    struct Slot {
+        uint64_t offset : 40 = 0;
+        uint64_t length : 24 = 0;
+    };
+    static_assert(sizeof(Slot) == sizeof(uint64_t));
+
+    std::vector<Slot> slots_;
+    std::vector<bool> occupied_;
+    std::vector<char> arena_;
+};
+
+// Read-only mapping of a whole file, unmapped on destruction.
+class FileMapping {
+public:
+    FileMapping() = default;
+
+    FileMapping(FileMapping &&other) noexcept;
+
+    FileMapping &operator=(FileMapping &&other) noexcept;
+
+    ~FileMapping();
+
+    bool Open(const std::string &path);
+
+    const std::byte *Data() const;
+
+    size_t Size() const;
+
+private:
+    void Close();
+
+    void *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Slots of a fingerprint-only set: a slot holds a Fingerprint-wide hash
+// of its key instead of the key, so a key outside the set matches with
+// probability kFalsePositiveRate. Empty slots repeat a stored fingerprint,
+// which keeps the rate the same for every slot.
+//
+// With a key file, the keys are also written in slot order to a file and
+// every fingerprint match is checked against a mapping of it. Only
+// matching lookups read the file, so the keys stay out of memory while
+// the answers become exact.
+template<typename T, typename Fingerprint = uint8_t>
+class FingerprintSlots {
+    static_assert(std::is_integral_v<T> && std::is_unsigned_v<Fingerprint>);
+
+public:
+    static constexpr double kFalsePositiveRate =
+            1.0 / static_cast<double>(uint64_t(1) << (8 * sizeof(Fingerprint)));
+
+    // Set before Reset. Seal writes the key file to path and maps it.
+    void SetKeyFile(const std::string &path);
+
+    // After Seal: whether matches are checked against the key file. False
+    // without one, or if it could not be written or mapped.
+    bool IsVerified() const;
+
+    void Reset(size_t size);
+
+    void Assign(size_t position, const T &value);
+
+    void Seal();
+
+    void Prefetch(size_t position) const;
+
+    bool Matches(size_t position, const T &value) const;
+
+private:
+    static Fingerprint CalcFingerprint(const T &value);
+
+    std::vector<Fingerprint> fingerprints_;
+    std::vector<bool> occupied_;
+    // Keys by slot, kept from Reset to Seal for the key file only.
+    std::vector<T> keys_;
+    std::string key_file_path_;
+    FileMapping key_file_;
+    const T *verified_keys_ = nullptr;
+    bool verified_ = false;
+
+    static const uint64_t kFingerprintSeed = 0xbb67ae8584caa73b;
+};
+
+// Slot policies that can verify matches against a key file.
+template<typename Slots>
+concept KeyFileSlots = requires(Slots &slots, const std::string &path) {
+    slots.SetKeyFile(path);
+    { std::as_const(slots).IsVerified() } -> std::same_as<bool>;
+};
+
+// Whitespace-separated decimal integers from a file descriptor, read in
+// blocks of kBlockSize bytes. Digits are converted eight at a time with
+// SWAR arithmetic on a 64-bit word, so a key costs a few multiplies and
+// almost no branches.
+class InputReader {
+public:
+    explicit InputReader(int descriptor);
+
+    // Reads an optionally signed integer in the range of T. Returns false
+    // at the end of input, or if the next token is not such an integer:
+    // that token is skipped and HasError() turns true.
+    template<typename T>
+    bool ReadInteger(T *value);
+
+    // Whether ReadInteger has met a token that is not an integer in range,
+    // or a required value was missing.
+    bool HasError() const;
+
+    static const size_t kBlockSize = 1 << 20;
+
+    // Reads the next run of non-whitespace bytes, of any length. Returns
+    // false at the end of input.
+    bool ReadToken(std::string *token);
+
+    // ReadInteger and ReadToken for values the input has to hold: the end
+    // of input is an error too.
+    template<typename T>
+    bool ReadRequiredInteger(T *value);
+
+    bool ReadRequiredToken(std::string *token);
+
+private:
+    // The sign and the digits of the next token. Returns false at the end
+    // of input, or, after SkipMalformedToken, if the token is not an
+    // integer or its magnitude does not fit 64 bits.
+    bool ReadSignAndMagnitude(bool *negative, uint64_t *magnitude);
+
+    // Skips whitespace, refilling as needed. Returns false at the end of
+    // input.
+    bool SkipWhitespace();
+
+    // Moves the unread bytes to the front and reads more after them.
+    void Refill();
+
+    // Skips the rest of the current token and marks the input malformed.
+    void SkipMalformedToken();
+
+    // Zero bytes after the data, so an 8-byte load never leaves the buffer.
+    static const size_t kPadding = 8;
+
+    int descriptor_;
+    std::vector<char> buffer_;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool end_of_input_ = false;
+    bool error_ = false;
+};
+
+// Feeds InputReader the inputs it is most likely to get wrong: signs,
+// long runs of leading zeros, integers across the kBlockSize boundary,
+// malformed tokens, values out of range and counts that do not match the
+// values. Reports failures to out and returns false on any.
+bool CheckInputReader(std::ostream &out);
+
+// Builds one key set as a FlatPerfectHashTable in memory, saved and opened
+// again, and with BuildImage over many partitions, and checks that all
+// three answer every query alike. Reports failures to out and returns
+// false on any.
+bool CheckImageRoundTrip(std::ostream &out);
+
+// 0 if every value input has read was well formed and in range and none
+// was missing; otherwise reports it and returns 1, the exit code of main.
+int CheckInputErrors(const InputReader &input);
+
+// A size followed by that many integers.
+template<typename T>
+std::vector<T> ReadVector(InputReader &in);
+
+// Answers to a file descriptor through one kBufferSize buffer, flushed
+// with large write calls. Text mode writes "Yes\n" or "No\n" per query;
+// binary mode writes one bit per query, least significant bit first, with
+// the last byte zero-padded. Blocks of answers are formatted by Format,
+// which any number of threads may call at once, and written by Write in
+// query order.
+class ResultWriter {
+public:
+    ResultWriter(int descriptor, bool binary);
+
+    ~ResultWriter();
+
+    // Bytes Format may use for count answers.
+    size_t MaxFormattedSize(size_t count) const;
+
+    // Formats a block of answers, found[i] nonzero iff its query i is in
+    // the set, into bytes, which holds MaxFormattedSize(found.size()),
+    // and returns the number of bytes used. In binary mode a block starts
+    // a new byte, so every block but the last needs a multiple of 8
+    // answers.
+    size_t Format(std::span<const uint8_t> found, char *bytes) const;
+
+    // Appends bytes made by Format.
+    void Write(std::span<const char> bytes);
+
+    void Flush();
+
+    // Whether some answers could not be written. Answers are dropped from
+    // the first failed write on.
+    bool HasError() const;
+
+private:
+    void Drain();
+
+    static const size_t kBufferSize = 1 << 20;
+
+    int descriptor_;
+    bool binary_;
+    std::vector<char> buffer_;
+    size_t size_ = 0;
+    bool error_ = false;
+};
+
+// CheckInputErrors after flushing output, and 1 as well, after reporting
+// it, if output could not write every answer.
+int CheckErrors(const InputReader &input, ResultWriter &output);
+
+// FIFO between threads holding at most capacity items. Push blocks while
+// it is full and Pop while it is empty; after Close, Push fails and Pop
+// fails once the queue is drained.
+template<typename Item>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    bool Push(Item item);
+
+    bool Pop(Item *item);
+
+    void Close();
+
+private:
+    size_t capacity_;
+    std::deque<Item> items_;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+// Calls body(worker, index) for every index in [0, count) on up to
+// threads threads. Each worker starts with an equal share of the range and
+// steals half of another worker's remainder once its own runs out, so
+// skewed per-index costs still keep every thread busy.
+template<typename Body>
+void ParallelFor(size_t count, size_t threads, Body body);
+
+// SplitMix64 finalizer: a bijection that scrambles all 64 bits.
+uint64_t MixBits(uint64_t value);
+
+// SplitMix64: the whole state is a single 64-bit counter, so a fresh
+// stream keyed by a bucket index costs nothing to set up.
+class SplitMix64 {
+public:
+    explicit SplitMix64(uint64_t seed = 0) : state_(seed) {}
+
+    uint64_t operator()();
+
+private:
+    uint64_t state_;
+};
 
 struct Hash {
     explicit Hash(std::mt19937 &generator) : Hash(generator(), generator()) {}
 
+    explicit Hash(SplitMix64 &generator) : Hash(generator(), generator()) {}
+
     explicit Hash(size_t multiplier_value = 0, size_t adder_value = 0);
 
     size_t operator()(int value) const;
 
+    // Position of value in a table of range slots.
+    size_t operator()(int value, size_t range) const;
+
 private:
     size_t multiplier_value;
     size_t adder_valuer;
     static const size_t kPrimeNumber = 2000000011;
 };
 
-template<typename T, typename Hash>
-class FixedSet {
-public:
-    FixedSet() : inner_data_size_(0), is_initialized_(false) {}
+// Dietzfelbinger's multiply-add-shift: (a * x + b) mod 2^64 div 2^32 is
+// strongly universal for 32-bit keys, so the FKS bounds still hold.
+// The range is reduced by a multiply-high instead of a modulo, so the
+// lookup path has no division at all.
+struct MultiplyShiftHash {
+    explicit MultiplyShiftHash(std::mt19937 &generator);
+
+    explicit MultiplyShiftHash(SplitMix64 &generator);
+
+    explicit MultiplyShiftHash(uint64_t multiplier_value = 0, uint64_t adder_value = 0);
+
+    size_t operator()(int value) const;
+
+    size_t operator()(int value, size_t range) const;
+
+    uint64_t GetMultiplier() const;
+
+    uint64_t GetAdder() const;
+
+private:
+    uint64_t multiplier_value_;
+    uint64_t adder_value_;
+};
+
+// Multiply-add-shift for 64-bit keys: (a * x + b) mod 2^128 div 2^64 with
+// 128-bit a and b, MultiplyShiftHash one word wider, so the whole 64-bit
+// universe is hashed universally. The range is reduced by a 64-bit
+// multiply-high.
+struct MultiplyShiftHash64 {
+    explicit MultiplyShiftHash64(std::mt19937 &generator);
+
+    explicit MultiplyShiftHash64(SplitMix64 &generator);
+
+    explicit MultiplyShiftHash64(unsigned __int128 multiplier_value = 0,
+                                 unsigned __int128 adder_value = 0);
+
+    uint64_t operator()(uint64_t value) const;
+
+    size_t operator()(uint64_t value, size_t range) const;
+
+private:
+    unsigned __int128 multiplier_value_;
+    unsigned __int128 adder_value_;
+};
+
+// Keyed MixBits. On 64-bit words it is a bijection, so distinct keys never
+// collide before the range reduction, which is a 128-bit multiply-high and
+// works for ranges past 2^32.
+struct MixHash {
+    explicit MixHash(SplitMix64 &generator) : seed_(generator()) {}
+
+    explicit MixHash(uint64_t seed = 0) : seed_(seed) {}
+
+    uint64_t operator()(uint64_t value) const;
+
+    size_t operator()(uint64_t value, size_t range) const;
+
+private:
+    uint64_t seed_;
+};
+
+// Seeded hash of a byte string. 32-byte blocks are split among four
+// independent 64-bit lanes, each a multiply-xorshift step per word, so
+// the lanes run in parallel and the loop vectorizes where 64-bit
+// multiplies do. The words of the tail go to the lanes in order, and the
+// lanes and the length are folded by MixBits.
+struct StringHash {
+    explicit StringHash(SplitMix64 &generator) : seed_(generator()) {}
+
+    explicit StringHash(uint64_t seed = 0) : seed_(seed) {}
+
+    uint64_t operator()(std::string_view value) const;
+
+    size_t operator()(std::string_view value, size_t range) const;
+
+private:
+    uint64_t seed_;
+};
+
+// Split block Bloom filter of 64-bit key hashes. A key sets one bit in
+// each of the eight 32-bit words of one 32-byte block, so a probe reads a
+// single cache line and is one 256-bit test. At kBitsPerKey bits per key
+// about 0.1% of absent keys pass.
+class BlockedBloomFilter {
+public:
+    static const size_t kWords = 8;
+    // Word i of a key's mask has the bit given by the high five bits of
+    // the low hash word times kSalts[i].
+    static constexpr uint32_t kSalts[kWords] = {0x47b6137b, 0x44974d91, 0x8824ad5b, 0xa2b7289d,
+                                                0x705495c7, 0x2df1424b, 0x9efc4947, 0x5c6bfb31};
+
+    void Reset(size_t size);
+
+    void Insert(uint64_t hash);
+
+    void Prefetch(uint64_t hash) const;
+
+    bool MayContain(uint64_t hash) const;
+
+private:
+    struct alignas(32) Block {
+        uint32_t words[kWords];
+    };
+
+    size_t CalcBlock(uint64_t hash) const;
+
+    std::vector<Block> blocks_;
+
+    static const size_t kBitsPerKey = 16;
+};
+
+// Whether block has every bit of the mask hash selects, one per word.
+bool BloomBlockContainsScalar(const uint32_t *block, uint32_t hash);
+
+bool BloomBlockContainsAvx2(const uint32_t *block, uint32_t hash);
+
+// Shared first-level logic. Derived provides InitBufferAndSize,
+// TryFillingHashTable and HasKey; they are resolved at compile time, so a
+// Derived with non-virtual hooks gets a fully inlined lookup.
+template<typename Derived, typename T, typename Hash>
+class FixedSetBase {
+public:
+    FixedSetBase() : inner_data_size_(0), build_threads_(1), is_initialized_(false) {}
+
+    // The hash search draws from a SplitMix64 stream keyed by seed.
+    void Initialize(std::span<const T> data, uint64_t seed = 0);
+
+    bool Contains(const T &value) const;
+
+    // Number of threads two-level tables use to build their second level.
+    // The result does not depend on it.
+    void SetBuildThreads(size_t threads);
+
+    // Whether Initialize also builds a BlockedBloomFilter of the keys that
+    // Contains consults before the first level, so most absent keys are
+    // rejected after one cache line. Set before Initialize; tables loaded
+    // by Restore have none.
+    void SetPrefilter(bool enabled);
+
+protected:
+    size_t CalcInnerPosition(const T &value) const;
+
+    const Hash &GetHash() const;
+
+    size_t inner_data_size_;
+
+    size_t build_threads_;
+
+    std::vector<size_t> CalcDistribution(std::span<const T> data);
+
+    // Marks the table built with hash over inner_data_size positions, for
+    // tables whose contents are loaded rather than built.
+    void Restore(const Hash &hash, size_t inner_data_size);
+
+    // Null without a prefilter.
+    const BlockedBloomFilter *GetPrefilter() const;
+
+    uint64_t CalcPrefilterHash(const T &value) const;
+
+    // Counting sort by first-level position: one prefix-sum pass and one
+    // scatter into a single buffer. Keys of position i end up in
+    // [(*starts)[i], (*starts)[i + 1]).
+    std::vector<T> PartitionByPosition(std::span<const T> data,
+                                       const std::vector<size_t> &distribution,
+                                       std::vector<size_t> *starts) const;
+
+private:
+    Derived &Self();
+
+    const Derived &Self() const;
+
+    struct Prefilter {
+        Hash hash;
+        BlockedBloomFilter filter;
+    };
+
+    bool is_initialized_;
+    Hash hash_;
+    // Held by pointer: the second-level tables of PerfectHashTable are
+    // FixedSets too, and cost only a null pointer each this way.
+    std::unique_ptr<Prefilter> prefilter_;
+
+    static const uint64_t kPrefilterHashSeed = 0xa54ff53a5f1d36f1;
+};
+
+template<typename T, typename Hash>
+class FixedSet : public FixedSetBase<FixedSet<T, Hash>, T, Hash> {
+    friend class FixedSetBase<FixedSet<T, Hash>, T, Hash>;
+
+private:
+    virtual void InitBufferAndSize(size_t size) = 0;
+
+    virtual bool TryFillingHashTable(std::span<const T> data) = 0;
+
+    virtual bool HasKey(const T &value) const = 0;
+};
+
+// A lookup as a coroutine: it runs up to its first prefetch when created,
+// suspends, and reads the line once resumed. The caller resumes it until
+// Done(). Frames come from a per-thread pool, so starting a lookup does not
+// hit the allocator.
+class LookupTask {
+public:
+    struct promise_type {
+        bool result = false;
+
+        LookupTask get_return_object() {
+            return LookupTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        void return_value(bool value) { result = value; }
+
+        void unhandled_exception() { std::terminate(); }
+
+        static void *operator new(size_t size);
+
+        static void operator delete(void *frame, size_t size);
+    };
+
+    LookupTask() = default;
+
+    LookupTask(LookupTask &&other) noexcept;
+
+    LookupTask &operator=(LookupTask &&other) noexcept;
+
+    ~LookupTask();
+
+    // Runs the lookup up to its next suspension point.
+    void Resume();
+
+    bool Done() const;
+
+    bool Result() const;
+
+private:
+    explicit LookupTask(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Runs lookup(keys[i]) for every i, keeping width lookups in flight and
+// resuming them round-robin, so the prefetch of one lookup overlaps the
+// work of the others. consume(i, found) is called as lookups finish, which
+// is not in the order of keys.
+template<typename T, typename Lookup, typename Consume>
+void InterleaveLookups(std::span<const T> keys, size_t width, Lookup lookup, Consume consume);
+
+// How FixedSetBase reaches the InitBufferAndSize, TryFillingHashTable
+// and HasKey of a table: through the vtable of FixedSet, or resolved at
+// compile time, so that both levels of Contains inline into the caller.
+enum class Dispatch { kVirtual, kInline };
+
+template<typename Table, typename T, typename Hash, Dispatch dispatch>
+using DispatchedFixedSet = std::conditional_t<dispatch == Dispatch::kVirtual, FixedSet<T, Hash>,
+                                              FixedSetBase<Table, T, Hash>>;
+
+template<typename T, typename Hash, typename Slots = OptionalSlots<T>,
+         Dispatch dispatch = Dispatch::kVirtual>
+class PerfectHashFirstLevelHashTable
+        : public DispatchedFixedSet<PerfectHashFirstLevelHashTable<T, Hash, Slots, dispatch>, T,
+                                    Hash, dispatch> {
+    friend class FixedSetBase<PerfectHashFirstLevelHashTable, T, Hash>;
+
+public:
+    // Prefetches the slot value would be stored in.
+    void Prefetch(const T &value) const;
+
+private:
+    Slots inner_data_;
+
+    void InitBufferAndSize(size_t size);
+
+    bool HasKey(const T &value) const;
+
+    bool TryFillingHashTable(std::span<const T> data);
+};
+
+
+template<typename T, typename Hash, typename Slots = OptionalSlots<T>,
+         Dispatch dispatch = Dispatch::kVirtual>
+class PerfectHashTable
+        : public DispatchedFixedSet<PerfectHashTable<T, Hash, Slots, dispatch>, T, Hash, dispatch> {
+    friend class FixedSetBase<PerfectHashTable, T, Hash>;
+
+public:
+    // Contains as a LookupTask that suspends before each dependent load:
+    // the prefilter block, if any, the bucket and the slot.
+    LookupTask ContainsAsync(T value) const;
+
+private:
+    std::vector<PerfectHashFirstLevelHashTable<T, Hash, Slots, dispatch>> hashTable_;
+
+    void InitBufferAndSize(size_t size);
+
+    bool HasKey(const T &value) const;
+
+    bool TryFillingHashTable(std::span<const T> data);
+
+    size_t kMemoryRepletionRatio = 4;
+};
+
+template<typename T, typename Hash, typename Slots = OptionalSlots<T>>
+using InlinePerfectHashTable = PerfectHashTable<T, Hash, Slots, Dispatch::kInline>;
+
+// Bucket header of FlatPerfectHashTable. A bucket of k keys owns the k * k
+// slots from offset on and places its keys with CalcBucketSlot under seed.
+// The three are packed into one word, offset in the low kOffsetBits, then
+// k, then the seed, so a header is 8 bytes and a vector kernel gathers it
+// with one load.
+struct FlatBucketHeader {
+    static constexpr int kOffsetBits = 40;
+    static constexpr int kKeysBits = 8;
+    static constexpr int kSeedBits = 16;
+    static constexpr uint64_t kMaxOffset = (uint64_t(1) << kOffsetBits) - 1;
+    static constexpr size_t kMaxKeys = (size_t(1) << kKeysBits) - 1;
+    static constexpr uint32_t kMaxSeed = (uint32_t(1) << kSeedBits) - 1;
+
+    FlatBucketHeader() = default;
+
+    FlatBucketHeader(uint64_t offset, size_t keys, uint32_t seed);
+
+    uint64_t Offset() const;
+
+    // Slots of the bucket, k * k.
+    uint64_t Size() const;
+
+    uint32_t Seed() const;
+
+    uint64_t word = 0;
+};
+
+// Slot of a key among the size slots of a bucket with the given seed.
+// input is the key itself for integer keys, so two keys never collide
+// before the mix, and its first-level hash otherwise. The seed is mixed in
+// as the pilots of MinimalPerfectHashTable are, and the range is reduced
+// from the high 32 bits, so the vector kernels need no multiply-high.
+size_t CalcBucketSlot(uint64_t input, uint32_t seed, uint64_t size);
+
+// Raw layout of a FlatPerfectHashTable<int, MultiplyShiftHash,
+// FillerSlots<int>> for the vectorized lookup kernels.
+struct FlatLookupView {
+    uint64_t multiplier;
+    uint64_t adder;
+    uint64_t buckets_size;
+    const FlatBucketHeader *headers;
+    const int *slots;
+};
+
+bool ContainsScalar(const FlatLookupView &view, int value);
+
+// Lookup kernels of ContainsBatch. The active one is picked from cpuid at
+// startup, so one binary runs the widest kernel on every machine;
+// SetLookupKernel forces another one, e.g. for benchmarking.
+enum class LookupKernel {
+    kScalar,
+    kAvx2,
+    kAvx512
+};
+
+LookupKernel DetectLookupKernel();
+
+bool IsLookupKernelSupported(LookupKernel kernel);
+
+LookupKernel GetLookupKernel();
+
+void SetLookupKernel(LookupKernel kernel);
+
+bool ParseLookupKernel(const std::string &name, LookupKernel *kernel);
+
+const char *GetLookupKernelName(LookupKernel kernel);
+
+// Vectorized ContainsBatch. Multiply-shift needs 64-bit lanes, so a
+// vector holds 4 keys with AVX2 and 8 with AVX-512. Keys go in groups of
+// kSimdGroupSize with the same three stages as the scalar batch: hash
+// and prefetch headers, gather headers and prefetch slots, gather slots
+// and compare.
+const size_t kSimdGroupSize = 32;
+
+void ContainsBatchAvx2(const FlatLookupView &view, std::span<const int> keys,
+                       std::span<uint8_t> out);
+
+void ContainsBatchAvx512(const FlatLookupView &view, std::span<const int> keys,
+                         std::span<uint8_t> out);
+
+// Whether a 64-byte block of 16 ints holds value, with one or two vector
+// compares.
+bool BlockContainsAvx2(const int *block, int value);
+
+bool BlockContainsAvx512(const int *block, int value);
+
+// Same FKS scheme as PerfectHashTable, but every second-level table lives
+// in one contiguous slot array and is described by a compact header, so a
+// lookup touches the header line and the slot line only.
+template<typename T, typename Hash, typename Slots = OptionalSlots<T>>
+class FlatPerfectHashTable
+        : public FixedSetBase<FlatPerfectHashTable<T, Hash, Slots>, T, Hash> {
+    friend class FixedSetBase<FlatPerfectHashTable<T, Hash, Slots>, T, Hash>;
+
+public:
+    // out[i] = Contains(keys[i]). Keys go in groups of kBatchGroupSize:
+    // hash all and prefetch their headers, then prefetch their slots, then
+    // compare, so the cache misses of a group overlap instead of queueing.
+    // With a prefilter, the filter blocks are probed group by group first,
+    // and only the keys that pass go on, through the scalar stages.
+    void ContainsBatch(std::span<const T> keys, std::span<uint8_t> out) const;
+
+    // Contains as a LookupTask that suspends before each dependent load:
+    // the prefilter block, if any, the bucket header and the slot.
+    LookupTask ContainsAsync(T value) const;
+
+    FlatLookupView GetLookupView() const
+    requires std::is_same_v<T, int> && std::is_same_v<Hash, MultiplyShiftHash> &&
+             std::is_same_v<Slots, FillerSlots<int>>;
+
+    // Writes the table as an image that Open can map back. The image holds
+    // offsets only, never pointers, so it is valid at any address.
+    bool Save(const std::string &path) const requires std::is_same_v<Slots, FillerSlots<T>>;
+
+    // Maps an image written by Save and serves lookups straight from the
+    // mapping: nothing is parsed or copied, so opening takes the same time
+    // for any table size. The image is trusted beyond its header.
+    bool Open(const std::string &path) requires std::is_same_v<Slots, FillerSlots<T>>;
+
+    // Writes the image Save would write for the keys of next_key, then
+    // opens it, without ever holding all keys in memory. next_key(&key)
+    // returns false after the last key. Keys are spilled to disk and split
+    // into partitions of consecutive first-level buckets, and the second
+    // level is built one partition at a time in about memory_budget bytes.
+    // A byte per bucket for the first-level histogram is kept on top of
+    // that. Temporary files are created next to path.
+    template<typename KeySource>
+    bool BuildImage(KeySource next_key, const std::string &path, size_t memory_budget,
+                    uint64_t seed = 0) requires std::is_same_v<Slots, FillerSlots<T>>;
+
+    // Checks fingerprint matches against the keys kept in a file at path,
+    // see FingerprintSlots. Set before Initialize.
+    void SetKeyFile(const std::string &path) requires KeyFileSlots<Slots>;
+
+    bool IsVerified() const requires KeyFileSlots<Slots>;
+
+private:
+    using BucketHeader = FlatBucketHeader;
+
+    // Image layout: this header, the bucket headers at buckets_offset and
+    // the slots at slots_offset, both aligned to kImageAlignment. Words are
+    // in host byte order.
+    struct ImageHeader {
+        char magic[8];
+        uint64_t key_size;
+        uint64_t bucket_header_size;
+        uint64_t buckets_size;
+        uint64_t buckets_offset;
+        uint64_t slots_size;
+        uint64_t slots_offset;
+        Hash hash;
+    };
+
+    // The header of an image with these sections, laid out as above.
+    static ImageHeader MakeImageHeader(const Hash &hash, uint64_t buckets_size,
+                                       uint64_t slots_size);
+
+    // Built buckets live in buckets_, opened ones in mapping_; lookups go
+    // through headers_ either way.
+    std::vector<BucketHeader> buckets_;
+    const BucketHeader *headers_ = nullptr;
+    Slots slots_;
+    FileMapping mapping_;
+
+    void InitBufferAndSize(size_t size);
+
+    bool HasKey(const T &value) const;
+
+    bool TryFillingHashTable(std::span<const T> data);
+
+    // The three stages of ContainsBatch for the keys at indices, at most
+    // kBatchGroupSize of them.
+    void ContainsGroup(std::span<const T> keys, std::span<const size_t> indices,
+                       std::span<uint8_t> out) const;
+
+    // The input of CalcBucketSlot for value, see there. hash is the
+    // first-level hash.
+    static uint64_t CalcBucketInput(const Hash &hash, const T &value);
+
+    size_t CalcSlot(const BucketHeader &header, const T &value) const;
+
+    // Sets the seed of header to the first one that maps the keys of its
+    // bucket to distinct slots. Seeds are tried in order, so the result
+    // does not depend on which thread or pass builds the bucket. Returns
+    // false if none of them does, which takes two keys with the same input.
+    static bool SearchBucketSeed(const Hash &hash, std::span<const T> keys,
+                                 BucketHeader *header, std::vector<uint8_t> *occupied);
+
+    size_t kMemoryRepletionRatio = 4;
+    static constexpr size_t kBatchGroupSize = 16;
+    static constexpr char kImageMagic[8] = {'F', 'L', 'A', 'T', 'F', 'K', 'S', '2'};
+    static constexpr size_t kImageAlignment = 64;
+    // Keys per read or write buffer of BuildImage, and partition files it
+    // fills in one pass over the spilled keys.
+    static constexpr size_t kExternalBufferKeys = 1 << 16;
+    static constexpr size_t kMaxOpenPartitions = 256;
+};
+
+// Set of strings looked up by std::string_view: the FKS layout of
+// FlatPerfectHashTable, with StringHash on both levels and the strings
+// copied into an ArenaSlots arena.
+using StringFixedSet = FlatPerfectHashTable<std::string_view, StringHash, ArenaSlots>;
+
+// PTHash-style minimal perfect hashing. The first-level hash splits keys
+// into buckets of about kAverageBucketSize, and every bucket keeps a 16-bit
+// pilot that moves its keys to free slots. Slots are filled at load
+// ~0.97; the few keys that land past n are remapped into the holes below
+// n, so the keys themselves sit in a dense n-slot array. The function
+// takes about 5 bits per key. With FingerprintSlots the whole set is
+// that plus one fingerprint per key.
+template<typename T, typename Hash, typename Slots = FillerSlots<T>>
+class MinimalPerfectHashTable
+        : public FixedSetBase<MinimalPerfectHashTable<T, Hash, Slots>, T, Hash> {
+    friend class FixedSetBase<MinimalPerfectHashTable<T, Hash, Slots>, T, Hash>;
+
+public:
+    // As in FlatPerfectHashTable.
+    void SetKeyFile(const std::string &path) requires KeyFileSlots<Slots>;
+
+    bool IsVerified() const requires KeyFileSlots<Slots>;
+
+private:
+    std::vector<uint16_t> pilots_;
+    std::vector<uint32_t> remap_;
+    Slots slots_;
+    // Number of keys, and of slots_.
+    size_t keys_size_ = 0;
+    size_t slots_size_ = 0;
+    Hash position_hash_;
+    SplitMix64 random_generator_;
+
+    void InitBufferAndSize(size_t size);
+
+    bool HasKey(const T &value) const;
+
+    bool TryFillingHashTable(std::span<const T> data);
+
+    size_t CalcSlot(const T &value, uint16_t pilot) const;
+
+    static const size_t kAverageBucketSize = 4;
+    static const size_t kSpareSlotsRatio = 30;
+    static const uint64_t kPositionHashSeed = 0x2545f4914f6cdd1d;
+};
+
+// BBHash minimal perfect hash function. Level i is a bitarray of
+// kGamma * (keys left) bits; a key stays at the first level where no
+// other remaining key hits its bit, and the bits of the others are
+// cleared. The index of a key is the rank of its bit over all levels.
+// Keys still colliding after kMaxLevels levels go to a sorted fallback.
+// Every level is built in parallel with atomic bit operations, and only
+// the colliding keys are copied, so peak memory stays close to the input.
+template<typename T, typename Hash>
+class BBHashFunction {
+public:
+    static const size_t kNotFound = SIZE_MAX;
+
+    void Build(std::span<const T> keys, size_t threads);
+
+    // Index in [0, Size()) for keys of the set. Other values get either
+    // kNotFound or the index of some key.
+    size_t Lookup(const T &value) const;
+
+    size_t Size() const;
+
+private:
+    struct Level {
+        Hash hash;
+        size_t offset = 0;
+        size_t size = 0;
+    };
+
+    std::vector<Level> levels_;
+    std::vector<uint64_t> bits_;
+    // Number of set bits before every block of kRankBlockWords words.
+    std::vector<size_t> ranks_;
+    std::vector<T> fallback_;
+    size_t size_ = 0;
+
+    size_t Rank(size_t position) const;
+
+    static const size_t kGamma = 2;
+    static const size_t kMaxLevels = 32;
+    static const size_t kRankBlockWords = 8;
+    static constexpr size_t kChunkSize = 1 << 16;
+    static const uint64_t kLevelHashSeed = 0x6a09e667f3bcc909;
+};
+
+// BBHashFunction plus the keys stored at their indices.
+template<typename T, typename Hash>
+class BBHashTable {
+public:
+    void Initialize(std::span<const T> data);
+
+    bool Contains(const T &value) const;
+
+    void SetBuildThreads(size_t threads);
+
+private:
+    BBHashFunction<T, Hash> function_;
+    std::vector<T> keys_;
+    size_t build_threads_ = 1;
+};
+
+// Keys hash to 64-byte blocks of kBlockSlots keys (16 ints, 8 int64s),
+// filled at load kLoadNumerator / kLoadDenominator, about 1.14x the key
+// memory. A full block spills to the next one. Empty slots repeat the
+// last key of their block, or any key if the block is empty, so a block
+// is full exactly when its last two slots differ, and no metadata is
+// needed beside the keys. A lookup compares a whole block at once and
+// moves on only from a full block, so most lookups touch one line.
+template<typename T, typename Hash>
+class BlockedHashTable : public FixedSetBase<BlockedHashTable<T, Hash>, T, Hash> {
+    friend class FixedSetBase<BlockedHashTable<T, Hash>, T, Hash>;
+
+private:
+    static const size_t kBlockSlots = 64 / sizeof(T);
+    static_assert(kBlockSlots >= 2);
+
+    struct alignas(64) Block {
+        T keys[kBlockSlots];
+    };
+
+    std::vector<Block> blocks_;
+
+    void InitBufferAndSize(size_t size);
+
+    bool HasKey(const T &value) const;
+
+    bool TryFillingHashTable(std::span<const T> data);
+
+    static bool IsFull(const Block &block);
+
+    static bool BlockContains(const Block &block, const T &value);
+
+    static const size_t kLoadNumerator = 7;
+    static const size_t kLoadDenominator = 8;
+};
+
+// Binary fuse filter (Graf and Lemire), an approximate set. A key passes
+// when its 8-bit fingerprint equals the xor of three array entries, one
+// in each of three consecutive segments picked by its hash. The array has
+// about 1.125 entries per key, so the filter takes about 9 bits per key,
+// and a key outside the set passes with probability 2^-8, about 0.4%.
+// Contains is three independent loads and no branches. The build peels
+// the hypergraph of the keys' entries and retries with another hash if
+// the peeling gets stuck; keys must be distinct.
+template<typename T, typename Hash>
+class BinaryFuseFilter {
+public:
+    void Initialize(std::span<const T> data);
+
+    bool Contains(const T &value) const;
+
+    void SetBuildThreads(size_t threads);
+
+private:
+    void CalcPositions(uint64_t hash, size_t positions[]) const;
+
+    static uint8_t CalcFingerprint(uint64_t hash);
+
+    // Returns false if the hypergraph of hashes cannot be peeled.
+    bool TryFillingFingerprints(std::span<const uint64_t> hashes);
+
+    Hash hash_;
+    std::vector<uint8_t> fingerprints_;
+    size_t size_ = 0;
+    size_t segment_length_ = 0;
+    size_t segment_count_length_ = 0;
+    size_t build_threads_ = 1;
+
+    static constexpr size_t kArity = 3;
+    static constexpr size_t kMaxSegmentLength = 1 << 18;
+    static constexpr size_t kChunkSize = 1 << 16;
+    static const uint64_t kFilterHashSeed = 0x3c6ef372fe94f82b;
+};
+
+struct Options {
+    bool benchmark = false;
+    // Run CheckInputReader and CheckImageRoundTrip instead of answering
+    // queries.
+    bool self_check = false;
+    // "fks" for FlatPerfectHashTable, "mphf" for MinimalPerfectHashTable,
+    // "bbhash" for BBHashTable, "blocked" for BlockedHashTable, "fuse" for
+    // BinaryFuseFilter, which answers with about 0.4% false positives.
+    std::string engine = "fks";
+    // "auto", "scalar", "avx2" or "avx512".
+    std::string kernel = "auto";
+    // Image of the fks table to write after the build, or to serve instead
+    // of building one. With open_path the input holds the queries only.
+    std::string save_path;
+    std::string open_path;
+    // With save_path, a nonzero budget streams the keys into an image built
+    // out of core in partitions of about this many megabytes.
+    size_t memory_budget_mb = 0;
+    // Answers as a bit per query instead of "Yes"/"No" lines.
+    bool binary_output = false;
+    // Threads answering queries; the output is the same for any number.
+    size_t query_threads = 1;
+    // Stream the queries through a reader, query_threads lookup workers
+    // and a writer instead of reading them all first.
+    bool pipeline = false;
+    // Nonzero: answer queries by this many interleaved ContainsAsync
+    // lookups per worker, on the engines that have it.
+    size_t interleave = 0;
+    // 32 for int keys, 64 for uint64_t keys.
+    size_t key_bits = 32;
+    // Keys and queries are whitespace-free strings, served by
+    // StringFixedSet.
+    bool string_keys = false;
+    // Nonzero: the fks or mphf table keeps fingerprints instead of keys,
+    // the narrowest whose false positive rate is at most this, so a query
+    // outside the set may be answered "Yes".
+    double fingerprint_fpr = 0;
+    // With fingerprint_fpr, the keys are kept in a file here and every
+    // fingerprint match is checked against it, so the answers are exact.
+    std::string key_file_path;
+    // Put a Bloom filter of the keys in front of the first level of the
+    // engines built on FixedSetBase.
+    bool prefilter = false;
+};
+
+// Returns false, after reporting it, on an unknown option or a value
+// that is not a number where one is expected.
+bool ParseOptions(int argc, char **argv, Options *options);
+
+// Parses all of text as a decimal number.
+template<typename Number>
+bool ParseNumber(std::string_view text, Number *value);
+
+// out[i] = static_hash_table.Contains(keys[i]): by interleave coroutine
+// lookups if interleave is nonzero and the table has ContainsAsync, else
+// by ContainsBatch where the table has it.
+template<typename HashTable, typename Key>
+void AnswerBlock(const HashTable &static_hash_table, std::span<const Key> keys,
+                 std::span<uint8_t> out, size_t interleave);
+
+template<typename HashTable, typename Key>
+void OperateQueries(const std::vector<Key> &queries, const HashTable &static_hash_table,
+                    ResultWriter &output, size_t threads, size_t interleave);
+
+// Reads the queries chunk by chunk on this thread, answers and formats
+// them on threads workers and writes them from a writer thread, in query
+// order. A fixed set of chunks circulates between the stages through
+// bounded queues, so memory does not grow with the number of queries.
+template<typename Key, typename HashTable>
+void PipelineQueries(InputReader &input, const HashTable &static_hash_table,
+                     ResultWriter &output, size_t threads, size_t interleave);
+
+// Reads the queries and answers them as options say.
+template<typename Key, typename HashTable>
+void AnswerQueries(InputReader &input, const HashTable &static_hash_table,
+                   const Options &options, ResultWriter &output);
+
+// Returns false, after reporting it, if the table cannot be saved to
+// options.save_path or its keys written to options.key_file_path.
+template<typename HashTable, typename Key>
+bool BuildAndOperateQueries(const std::vector<Key> &data, InputReader &input,
+                            const Options &options, ResultWriter &output);
+
+// Reads keys of type Key and queries from stdin and answers the queries
+// on stdout, with the engine and modes of options. KeyHash is the
+// first-level hash of the engines that take one.
+template<typename Key, typename KeyHash>
+int ServeQueries(const Options &options);
+
+// ServeQueries with FingerprintSlots<Key, Fingerprint> in the fks or mphf
+// table.
+template<typename Key, typename KeyHash, typename Fingerprint>
+int ServeFingerprintQueries(const std::vector<Key> &data, InputReader &input,
+                            const Options &options, ResultWriter &output);
+
+// ServeQueries for --string-keys. Only the fks layout, as StringFixedSet,
+// and the plain or multi-threaded query modes are supported.
+int ServeStringQueries(const Options &options);
+
+// Compares per-lookup time of the virtual and the devirtualized tables.
+// Returns false, after reporting it, if an exact table disagrees with the
+// virtual one on the number of hits, or a vector kernel disagrees with the
+// scalar one on any query.
+bool RunLookupBenchmark(std::ostream &out);
+
+int main(int argc, char **argv) {
+    std::ios_base::sync_with_stdio(false);
+    std::cin.tie(nullptr);
+
+    Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        return 1;
+    }
+    if (options.kernel != "auto") {
+        LookupKernel kernel;
+        if (!ParseLookupKernel(options.kernel, &kernel)) {
+            std::cerr << "Unknown kernel: " << options.kernel << "\n";
+            return 1;
+        }
+        if (!IsLookupKernelSupported(kernel)) {
+            std::cerr << "Kernel is not supported by this CPU: " << options.kernel << "\n";
+            return 1;
+        }
+        SetLookupKernel(kernel);
+    }
+    if (options.benchmark) {
+        return RunLookupBenchmark(std::cout) ? 0 : 1;
+    }
+    if (options.self_check) {
+        if (!CheckInputReader(std::cerr)) {
+            return 1;
+        }
+        std::cout << "InputReader: ok\n";
+        if (!CheckImageRoundTrip(std::cerr)) {
+            return 1;
+        }
+        std::cout << "Table images: ok\n";
+        return 0;
+    }
+
+    if ((!options.save_path.empty() || !options.open_path.empty()) && options.engine != "fks") {
+        std::cerr << "Table images are only supported by --engine=fks\n";
+        return 1;
+    }
+    if (options.string_keys) {
+        return ServeStringQueries(options);
+    }
+    if (options.key_bits == 64) {
+        return ServeQueries<uint64_t, MultiplyShiftHash64>(options);
+    }
+    if (options.key_bits != 32) {
+        std::cerr << "Unsupported key width: " << options.key_bits << "\n";
+        return 1;
+    }
+    return ServeQueries<int, MultiplyShiftHash>(options);
+}
+
+template<typename T>
+Optional<T> &Optional<T>::operator=(const T &value) {
+    value_ = value;
+    assigned_ = true;
+    return *this;
+}
+
+template<typename T>
+bool Optional<T>::IsAssigned() const {
+    return assigned_;
+}
+
+template<typename T>
+T Optional<T>::GetValue() const {
+    assert(assigned_);
+    return value_;
+}
+
+template<typename T>
+void OptionalSlots<T>::Reset(size_t size) {
+    slots_.assign(size, Optional<T>());
+}
+
+template<typename T>
+void OptionalSlots<T>::Assign(size_t position, const T &value) {
+    slots_[position] = value;
+}
+
+template<typename T>
+void OptionalSlots<T>::Prefetch(size_t position) const {
+    __builtin_prefetch(&slots_[position]);
+}
+
+template<typename T>
+bool OptionalSlots<T>::Matches(size_t position, const T &value) const {
+    const auto &slot = slots_[position];
+    return slot.IsAssigned() && slot.GetValue() == value;
+}
+
+template<typename... Vectors>
+void FillEmptySlots(const std::vector<bool> &occupied, Vectors &...slots) {
+    auto first_occupied = std::find(occupied.begin(), occupied.end(), true);
+    if (first_occupied == occupied.end()) {
+        return;
+    }
+    size_t first = first_occupied - occupied.begin();
+    for (size_t i = 0; i < occupied.size(); ++i) {
+        if (!occupied[i]) {
+            auto fill = [&](auto &vector) {
+                if (!vector.empty()) {
+                    vector[i] = vector[first];
+                }
+            };
+            (fill(slots), ...);
+        }
+    }
+}
+
+template<typename T>
+void FillerSlots<T>::Reset(size_t size) {
+    keys_.assign(size, T());
+    occupied_.assign(size, false);
+    data_ = keys_.data();
+    size_ = size;
+}
+
+template<typename T>
+void FillerSlots<T>::Assign(size_t position, const T &value) {
+    keys_[position] = value;
+    occupied_[position] = true;
+}
+
+template<typename T>
+void FillerSlots<T>::Seal() {
+    FillEmptySlots(occupied_, keys_);
+    occupied_ = std::vector<bool>();
+}
+
+template<typename T>
+void FillerSlots<T>::Attach(std::span<const T> keys) {
+    keys_ = std::vector<T>();
+    occupied_ = std::vector<bool>();
+    data_ = keys.data();
+    size_ = keys.size();
+}
+
+template<typename T>
+void FillerSlots<T>::Prefetch(size_t position) const {
+    __builtin_prefetch(&data_[position]);
+}
+
+template<typename T>
+bool FillerSlots<T>::Matches(size_t position, const T &value) const {
+    return data_[position] == value;
+}
+
+template<typename T>
+const T *FillerSlots<T>::Data() const {
+    return data_;
+}
+
+template<typename T>
+size_t FillerSlots<T>::Size() const {
+    return size_;
+}
+
+template<typename T>
+void BitmapSlots<T>::Reset(size_t size) {
+    keys_.assign(size, T());
+    occupancy_.assign((size + 63) / 64, 0);
+}
+
+template<typename T>
+bool BitmapSlots<T>::IsOccupied(size_t position) const {
+    return (occupancy_[position / 64] >> (position % 64)) & 1;
+}
+
+template<typename T>
+void BitmapSlots<T>::Assign(size_t position, const T &value) {
+    keys_[position] = value;
+    occupancy_[position / 64] |= uint64_t(1) << (position % 64);
+}
+
+template<typename T>
+void BitmapSlots<T>::Prefetch(size_t position) const {
+    __builtin_prefetch(&occupancy_[position / 64]);
+    __builtin_prefetch(&keys_[position]);
+}
+
+template<typename T>
+bool BitmapSlots<T>::Matches(size_t position, const T &value) const {
+    return IsOccupied(position) && keys_[position] == value;
+}
+
+template<typename T, typename Fingerprint>
+void FingerprintSlots<T, Fingerprint>::SetKeyFile(const std::string &path) {
+    key_file_path_ = path;
+}
+
+template<typename T, typename Fingerprint>
+bool FingerprintSlots<T, Fingerprint>::IsVerified() const {
+    return verified_;
+}
+
+template<typename T, typename Fingerprint>
+void FingerprintSlots<T, Fingerprint>::Reset(size_t size) {
+    fingerprints_.assign(size, 0);
+    occupied_.assign(size, false);
+    if (!key_file_path_.empty()) {
+        keys_.assign(size, T());
+    }
+    verified_keys_ = nullptr;
+    verified_ = false;
+}
+
+template<typename T, typename Fingerprint>
+void FingerprintSlots<T, Fingerprint>::Assign(size_t position, const T &value) {
+    fingerprints_[position] = CalcFingerprint(value);
+    occupied_[position] = true;
+    if (!keys_.empty()) {
+        keys_[position] = value;
+    }
+}
+
+template<typename T, typename Fingerprint>
+void FingerprintSlots<T, Fingerprint>::Seal() {
+    // keys_ is empty without a key file and is skipped then.
+    FillEmptySlots(occupied_, fingerprints_, keys_);
+    occupied_ = std::vector<bool>();
+    if (key_file_path_.empty()) {
+        return;
+    }
+    std::ofstream file(key_file_path_, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(keys_.data()), keys_.size() * sizeof(T));
+    file.close();
+    if (!file.fail()) {
+        // An empty file cannot be mapped, but then nothing is looked up.
+        verified_ = keys_.empty() || key_file_.Open(key_file_path_);
+        if (verified_ && !keys_.empty()) {
+            verified_keys_ = reinterpret_cast<const T *>(key_file_.Data());
+        }
+    }
+    keys_ = std::vector<T>();
+}
+
+template<typename T, typename Fingerprint>
+void FingerprintSlots<T, Fingerprint>::Prefetch(size_t position) const {
+    __builtin_prefetch(&fingerprints_[position]);
+}
+
+template<typename T, typename Fingerprint>
+bool FingerprintSlots<T, Fingerprint>::Matches(size_t position, const T &value) const {
+    if (fingerprints_[position] != CalcFingerprint(value)) {
+        return false;
+    }
+    return verified_keys_ == nullptr || verified_keys_[position] == value;
+}
+
+template<typename T, typename Fingerprint>
+Fingerprint FingerprintSlots<T, Fingerprint>::CalcFingerprint(const T &value) {
+    return static_cast<Fingerprint>(MixBits(static_cast<uint64_t>(value) ^ kFingerprintSeed) >>
+                                    (64 - 8 * sizeof(Fingerprint)));
+}
+
+void ArenaSlots::Reset(size_t size) {
+    slots_.assign(size, Slot());
+    occupied_.assign(size, false);
+    arena_.clear();
+}
+
+void ArenaSlots::Assign(size_t position, std::string_view value) {
+    assert(value.size() <= kMaxLength && arena_.size() + value.size() <= kMaxArenaSize);
+    slots_[position].offset = arena_.size();
+    slots_[position].length = value.size();
+    occupied_[position] = true;
+    arena_.insert(arena_.end(), value.begin(), value.end());
+}
+
+void ArenaSlots::Seal() {
+    FillEmptySlots(occupied_, slots_);
+    occupied_ = std::vector<bool>();
+    arena_.shrink_to_fit();
+}
+
+void ArenaSlots::Prefetch(size_t position) const {
+    __builtin_prefetch(&slots_[position]);
+}
+
+bool ArenaSlots::Matches(size_t position, std::string_view value) const {
+    const auto &slot = slots_[position];
+    return slot.length == value.size() &&
+           std::memcmp(arena_.data() + slot.offset, value.data(), value.size()) == 0;
+}
+
+uint64_t MixBits(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
+
+uint64_t SplitMix64::operator()() {
+    return MixBits(state_ += 0x9e3779b97f4a7c15);
+}
+
+Hash::Hash(size_t multiplier_value, size_t adder_value) :
+        multiplier_value(multiplier_value),
+        adder_valuer(adder_value) {}
+
+size_t Hash::operator()(int value) const {
+    return (value * multiplier_value + adder_valuer) % kPrimeNumber;
+}
+
+size_t Hash::operator()(int value, size_t range) const {
+    return (*this)(value) % range;
+}
+
+MultiplyShiftHash::MultiplyShiftHash(std::mt19937 &generator) {
+    multiplier_value_ = (uint64_t(generator()) << 32) | generator();
+    adder_value_ = (uint64_t(generator()) << 32) | generator();
+}
+
+MultiplyShiftHash::MultiplyShiftHash(SplitMix64 &generator) {
+    multiplier_value_ = generator();
+    adder_value_ = generator();
+}
+
+uint64_t StringHash::operator()(std::string_view value) const {
+    const uint64_t kMultiplier = 0x9e3779b97f4a7c15;
+    const size_t kLanes = 4;
+    uint64_t lanes[kLanes];
+    for (size_t lane = 0; lane < kLanes; ++lane) {
+        lanes[lane] = seed_ + lane * kMultiplier;
+    }
+    auto mix = [&](size_t lane, uint64_t word) {
+        lanes[lane] = (lanes[lane] ^ word) * kMultiplier;
+        lanes[lane] ^= lanes[lane] >> 32;
+    };
+    auto load = [&](size_t position, size_t bytes) {
+        uint64_t word = 0;
+        std::memcpy(&word, value.data() + position, bytes);
+        return word;
+    };
+    const size_t kBlockSize = kLanes * sizeof(uint64_t);
+    size_t size = value.size();
+    size_t begin = 0;
+    for (; begin + kBlockSize <= size; begin += kBlockSize) {
+        for (size_t lane = 0; lane < kLanes; ++lane) {
+            mix(lane, load(begin + lane * 8, 8));
+        }
+    }
+    // The rest goes word by word. The last partial word is read without
+    // leaving the string: as the tail of an overlapping 8-byte load, as
+    // two overlapping 4-byte loads, or as three bytes that cover 1 to 3.
+    size_t lane = 0;
+    for (; begin + 8 <= size; begin += 8) {
+        mix(lane++, load(begin, 8));
+    }
+    size_t rest = size - begin;
+    if (rest > 0) {
+        uint64_t word;
+        if (size >= 8) {
+            word = load(size - 8, 8) >> (8 * (8 - rest));
+        } else if (rest >= 4) {
+            word = load(begin, 4) | (load(size - 4, 4) << 32);
+        } else {
+            word = load(begin, 1) | (load(begin + rest / 2, 1) << 8) |
+                   (load(size - 1, 1) << 16);
+        }
+        mix(lane, word);
+    }
+    return MixBits(lanes[0] ^ std::rotl(lanes[1], 16) ^ std::rotl(lanes[2], 32) ^
+                   std::rotl(lanes[3], 48) ^ size);
+}
+
+size_t StringHash::operator()(std::string_view value, size_t range) const {
+    return static_cast<size_t>((static_cast<unsigned __int128>((*this)(value)) * range) >> 64);
+}
+
+MultiplyShiftHash64::MultiplyShiftHash64(std::mt19937 &generator) {
+    multiplier_value_ = 0;
+    adder_value_ = 0;
+    for (int word = 0; word < 4; ++word) {
+        multiplier_value_ = (multiplier_value_ << 32) | generator();
+        adder_value_ = (adder_value_ << 32) | generator();
+    }
+}
+
+MultiplyShiftHash64::MultiplyShiftHash64(SplitMix64 &generator) {
+    multiplier_value_ = (static_cast<unsigned __int128>(generator()) << 64) | generator();
+    adder_value_ = (static_cast<unsigned __int128>(generator()) << 64) | generator();
+}
+
+MultiplyShiftHash64::MultiplyShiftHash64(unsigned __int128 multiplier_value,
+                                         unsigned __int128 adder_value) :
+        multiplier_value_(multiplier_value),
+        adder_value_(adder_value) {}
+
+uint64_t MultiplyShiftHash64::operator()(uint64_t value) const {
+    return static_cast<uint64_t>((multiplier_value_ * value + adder_value_) >> 64);
+}
+
+size_t MultiplyShiftHash64::operator()(uint64_t value, size_t range) const {
+    return static_cast<size_t>((static_cast<unsigned __int128>((*this)(value)) * range) >> 64);
+}
+
+uint64_t MixHash::operator()(uint64_t value) const {
+    return MixBits(value ^ seed_);
+}
+
+size_t MixHash::operator()(uint64_t value, size_t range) const {
+    return (static_cast<unsigned __int128>((*this)(value)) * range) >> 64;
+}
+
+MultiplyShiftHash::MultiplyShiftHash(uint64_t multiplier_value, uint64_t adder_value) :
+        multiplier_value_(multiplier_value),
+        adder_value_(adder_value) {}
+
+size_t MultiplyShiftHash::operator()(int value) const {
+    return (multiplier_value_ * static_cast<uint32_t>(value) + adder_value_) >> 32;
+}
+
+size_t MultiplyShiftHash::operator()(int value, size_t range) const {
+    assert(range <= (uint64_t(1) << 32));
+    return ((*this)(value) * range) >> 32;
+}
+
+uint64_t MultiplyShiftHash::GetMultiplier() const {
+    return multiplier_value_;
+}
+
+uint64_t MultiplyShiftHash::GetAdder() const {
+    return adder_value_;
+}
+
+FileMapping::FileMapping(FileMapping &&other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+FileMapping &FileMapping::operator=(FileMapping &&other) noexcept {
+    if (this != &other) {
+        Close();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+}
+
+FileMapping::~FileMapping() {
+    Close();
+}
+
+bool FileMapping::Open(const std::string &path) {
+    Close();
+    int descriptor = open(path.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        close(descriptor);
+        return false;
+    }
+    void *data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    // The mapping keeps the file alive on its own.
+    close(descriptor);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    data_ = data;
+    size_ = status.st_size;
+    return true;
+}
+
+const std::byte *FileMapping::Data() const {
+    return static_cast<const std::byte *>(data_);
+}
+
+size_t FileMapping::Size() const {
+    return size_;
+}
+
+void FileMapping::Close() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+}
+
+InputReader::InputReader(int descriptor)
+        : descriptor_(descriptor), buffer_(kBlockSize + kPadding, 0) {}
+
+bool InputReader::ReadSignAndMagnitude(bool *negative, uint64_t *magnitude) {
+    if (!SkipWhitespace()) {
+        return false;
+    }
+    *negative = buffer_[begin_] == '-';
+    begin_ += *negative || buffer_[begin_] == '+';
+    uint64_t result = 0;
+    bool overflow = false;
+    size_t digits = 0;
+    size_t length;
+    do {
+        // Eight real bytes, unless the input ends first: a number is never
+        // cut at the end of a block.
+        if (end_ - begin_ < sizeof(uint64_t) && !end_of_input_) {
+            Refill();
+        }
+        uint64_t chunk;
+        std::memcpy(&chunk, &buffer_[begin_], sizeof(chunk));
+        // A byte is a digit iff it is 0x3? and stays 0x3? after adding 6.
+        // Carries only run towards later bytes, so they never hide the
+        // first non-digit.
+        uint64_t non_digits = ((chunk & 0xF0F0F0F0F0F0F0F0) ^ 0x3030303030303030) |
+                              (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) ^
+                               0x3030303030303030);
+        length = non_digits == 0 ? 8 : std::countr_zero(non_digits) / 8;
+        if (length == 0) {
+            break;
+        }
+        // Left-pad to eight digits, the first one in the lowest byte, and
+        // combine pairs, then quads, then the two halves.
+        chunk = (chunk & 0x0F0F0F0F0F0F0F0F) << (8 * (8 - length));
+        chunk = (chunk * 10 + (chunk >> 8)) & 0x00FF00FF00FF00FF;
+        chunk = (chunk * 100 + (chunk >> 16)) & 0x0000FFFF0000FFFF;
+        chunk = (chunk * 10000 + (chunk >> 32)) & 0x00000000FFFFFFFF;
+        static const uint64_t kPowersOfTen[] = {1, 10, 100, 1000, 10000, 100000, 1000000,
+                                                10000000, 100000000};
+        // Leading zeros never overflow, so only the value is limited, not
+        // the number of digits.
+        overflow |= __builtin_mul_overflow(result, kPowersOfTen[length], &result);
+        overflow |= __builtin_add_overflow(result, chunk, &result);
+        begin_ += length;
+        digits += length;
+    } while (length == 8);
+    // The token has to end right after its digits.
+    if (digits == 0 || overflow ||
+        (begin_ < end_ && static_cast<unsigned char>(buffer_[begin_]) > ' ')) {
+        SkipMalformedToken();
+        return false;
+    }
+    *magnitude = result;
+    return true;
+}
+
+template<typename T>
+bool InputReader::ReadInteger(T *value) {
+    static_assert(std::is_integral_v<T> && sizeof(T) <= sizeof(uint64_t));
+    bool negative;
+    uint64_t magnitude;
+    if (!ReadSignAndMagnitude(&negative, &magnitude)) {
+        return false;
+    }
+    uint64_t limit = negative ? (std::is_signed_v<T> ? uint64_t(std::numeric_limits<T>::max()) + 1
+                                                     : 0)
+                              : uint64_t(std::numeric_limits<T>::max());
+    if (magnitude > limit) {
+        error_ = true;
+        return false;
+    }
+    *value = static_cast<T>(negative ? 0 - magnitude : magnitude);
+    return true;
+}
+
+template<typename T>
+bool InputReader::ReadRequiredInteger(T *value) {
+    if (!ReadInteger(value)) {
+        error_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool InputReader::ReadRequiredToken(std::string *token) {
+    if (!ReadToken(token)) {
+        error_ = true;
+        return false;
+    }
+    return true;
+}
+
+bool InputReader::HasError() const {
+    return error_;
+}
+
+void InputReader::SkipMalformedToken() {
+    error_ = true;
+    while (true) {
+        while (begin_ < end_ && static_cast<unsigned char>(buffer_[begin_]) > ' ') {
+            ++begin_;
+        }
+        if (begin_ < end_ || end_of_input_) {
+            return;
+        }
+        Refill();
+    }
+}
+
+bool InputReader::ReadToken(std::string *token) {
+    if (!SkipWhitespace()) {
+        return false;
+    }
+    token->clear();
+    while (true) {
+        size_t end = begin_;
+        while (end < end_ && static_cast<unsigned char>(buffer_[end]) > ' ') {
+            ++end;
+        }
+        token->append(&buffer_[begin_], end - begin_);
+        begin_ = end;
+        if (begin_ < end_ || end_of_input_) {
+            return true;
+        }
+        Refill();
+    }
+}
+
+bool InputReader::SkipWhitespace() {
+    while (true) {
+        while (begin_ < end_ && static_cast<unsigned char>(buffer_[begin_]) <= ' ') {
+            ++begin_;
+        }
+        if (begin_ < end_ || end_of_input_) {
+            return begin_ < end_;
+        }
+        Refill();
+    }
+}
+
+void InputReader::Refill() {
+    std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+    end_ -= begin_;
+    begin_ = 0;
+    while (end_ < kBlockSize && !end_of_input_) {
+        ssize_t count = read(descriptor_, buffer_.data() + end_, kBlockSize - end_);
+        if (count > 0) {
+            end_ += count;
+        } else if (count == 0 || errno != EINTR) {
+            end_of_input_ = true;
+        }
+    }
+    std::fill(buffer_.begin() + end_, buffer_.begin() + end_ + kPadding, 0);
+}
+
+template<typename T>
+std::vector<T> ReadVector(InputReader &in) {
+    size_t size = 0;
+    in.ReadRequiredInteger(&size);
+    // The count is not trusted with more memory than values it has met.
+    const size_t kMaxReserve = 1 << 24;
+    std::vector<T> data;
+    data.reserve(std::min(size, kMaxReserve));
+    T value;
+    while (data.size() < size && in.ReadRequiredInteger(&value)) {
+        data.push_back(value);
+    }
+    return data;
+}
+
+int CheckInputErrors(const InputReader &input) {
+    if (!input.HasError()) {
+        return 0;
+    }
+    std::cerr << "Malformed or missing value in input\n";
+    return 1;
+}
+
+int CheckErrors(const InputReader &input, ResultWriter &output) {
+    output.Flush();
+    int status = CheckInputErrors(input);
+    if (output.HasError()) {
+        std::cerr << "Cannot write answers\n";
+        status = 1;
+    }
+    return status;
+}
+
+bool CheckInputReader(std::ostream &out) {
+    // Runs check on a reader of text; false if the text cannot be staged.
+    auto with_reader = [&](const std::string &text, auto check) {
+        std::FILE *file = std::tmpfile();
+        if (file == nullptr) {
+            out << "InputReader: cannot create a temporary file\n";
+            return false;
+        }
+        std::fwrite(text.data(), 1, text.size(), file);
+        std::fflush(file);
+        std::rewind(file);
+        InputReader reader(fileno(file));
+        check(reader);
+        std::fclose(file);
+        return true;
+    };
+
+    struct Case {
+        std::string text;
+        std::vector<int64_t> values;
+        bool error;
+    };
+    std::vector<Case> cases = {
+            {"2\n+5 7\n3\n5 +7 8\n", {2, 5, 7, 3, 5, 7, 8}, false},
+            {"-0 +0 -9223372036854775807 +9223372036854775807", {0, 0, -INT64_MAX, INT64_MAX},
+             false},
+            {std::string(40, '0') + "42 -" + std::string(25, '0') + "7", {42, -7}, false},
+            {"1 + 2 - 3 x4 5y 6", {1, 2, 3, 6}, true},
+            {"-9223372036854775808 9223372036854775808 -9223372036854775809 5", {INT64_MIN, 5},
+             true},
+            {"18446744073709551616 1234567890123456789012345 " + std::string(30, '9') + " 3", {3},
+             true},
+    };
+    // Numbers around the end of the first block, with and without a
+    // whitespace byte on the boundary.
+    for (size_t shift = 0; shift < 12; ++shift) {
+        Case block_case{std::string(InputReader::kBlockSize - shift, ' ') +
+                                "123456789012345 000000000000000000000009 -12",
+                        {123456789012345, 9, -12}, false};
+        cases.push_back(block_case);
+    }
+
+    bool passed = true;
+    for (size_t i = 0; i < cases.size(); ++i) {
+        const auto &test = cases[i];
+        std::vector<int64_t> values;
+        bool error = false;
+        bool staged = with_reader(test.text, [&](InputReader &reader) {
+            // More reads than any case has tokens; past the end every read
+            // fails.
+            const size_t kReads = 16;
+            for (size_t read = 0; read < kReads; ++read) {
+                int64_t value;
+                if (reader.ReadInteger(&value)) {
+                    values.push_back(value);
+                }
+            }
+            error = reader.HasError();
+        });
+        if (!staged) {
+            return false;
+        }
+        if (values != test.values || error != test.error) {
+            out << "InputReader: case " << i << " failed\n";
+            passed = false;
+        }
+    }
+
+    // ReadVector checks values against the key type, and the count both
+    // for its sign and against the values that follow.
+    struct VectorCase {
+        std::string text;
+        std::vector<int> values;
+        bool error;
+    };
+    std::vector<VectorCase> vector_cases = {
+            {"3 1 -2147483648 2147483647", {1, INT32_MIN, INT32_MAX}, false},
+            {"2 4294967297 7", {}, true},
+            {"2 7 -2147483649", {7}, true},
+            {"-1 5", {}, true},
+            {"3 1 2", {1, 2}, true},
+            {"", {}, true},
+    };
+    for (size_t i = 0; i < vector_cases.size(); ++i) {
+        const auto &test = vector_cases[i];
+        std::vector<int> values;
+        bool error = false;
+        bool staged = with_reader(test.text, [&](InputReader &reader) {
+            values = ReadVector<int>(reader);
+            error = reader.HasError();
+        });
+        if (!staged) {
+            return false;
+        }
+        if (values != test.values || error != test.error) {
+            out << "InputReader: vector case " << i << " failed\n";
+            passed = false;
+        }
+    }
+    std::vector<uint64_t> wide_values;
+    bool wide_error = false;
+    bool staged = with_reader("2 18446744073709551615 -1", [&](InputReader &reader) {
+        wide_values = ReadVector<uint64_t>(reader);
+        wide_error = reader.HasError();
+    });
+    if (!staged) {
+        return false;
+    }
+    if (wide_values != std::vector<uint64_t>{UINT64_MAX} || !wide_error) {
+        out << "InputReader: uint64_t vector case failed\n";
+        passed = false;
+    }
+    return passed;
+}
+
+ResultWriter::ResultWriter(int descriptor, bool binary)
+        : descriptor_(descriptor), binary_(binary), buffer_(kBufferSize) {}
+
+ResultWriter::~ResultWriter() {
+    Flush();
+}
+
+size_t ResultWriter::MaxFormattedSize(size_t count) const {
+    return binary_ ? (count + 7) / 8 : 4 * count;
+}
+
+size_t ResultWriter::Format(std::span<const uint8_t> found, char *bytes) const {
+    if (binary_) {
+        size_t size = (found.size() + 7) / 8;
+        std::fill(bytes, bytes + size, 0);
+        for (size_t i = 0; i < found.size(); ++i) {
+            bytes[i / 8] |= static_cast<char>(uint8_t(found[i] != 0) << (i % 8));
+        }
+        return size;
+    }
+    size_t size = 0;
+    for (auto answer : found) {
+        // Both answers are copied as four bytes; "No\n" just advances by
+        // three, so there is no branch on the answer.
+        std::memcpy(bytes + size, answer ? "Yes\n" : "No\n", 4);
+        size += answer ? 4 : 3;
+    }
+    return size;
+}
+
+void ResultWriter::Write(std::span<const char> bytes) {
+    while (!bytes.empty()) {
+        if (size_ == buffer_.size()) {
+            Drain();
+        }
+        size_t count = std::min(bytes.size(), buffer_.size() - size_);
+        std::memcpy(buffer_.data() + size_, bytes.data(), count);
+        size_ += count;
+        bytes = bytes.subspan(count);
+    }
+}
+
+void ResultWriter::Flush() {
+    Drain();
+}
+
+bool ResultWriter::HasError() const {
+    return error_;
+}
+
+void ResultWriter::Drain() {
+    size_t written = 0;
+    while (written < size_ && !error_) {
+        ssize_t count = write(descriptor_, buffer_.data() + written, size_ - written);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            error_ = true;
+            break;
+        }
+        written += count;
+    }
+    size_ = 0;
+}
+
+bool ParseOptions(int argc, char **argv, Options *options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        bool valid = true;
+        if (argument == "--benchmark") {
+            options->benchmark = true;
+        } else if (argument == "--self-check") {
+            options->self_check = true;
+        } else if (argument.rfind("--engine=", 0) == 0) {
+            options->engine = argument.substr(std::string("--engine=").size());
+        } else if (argument.rfind("--kernel=", 0) == 0) {
+            options->kernel = argument.substr(std::string("--kernel=").size());
+        } else if (argument.rfind("--save=", 0) == 0) {
+            options->save_path = argument.substr(std::string("--save=").size());
+        } else if (argument.rfind("--open=", 0) == 0) {
+            options->open_path = argument.substr(std::string("--open=").size());
+        } else if (argument.rfind("--query-threads=", 0) == 0) {
+            valid = ParseNumber(
+                    std::string_view(argument).substr(std::string("--query-threads=").size()),
+                    &options->query_threads);
+        } else if (argument.rfind("--key-bits=", 0) == 0) {
+            valid = ParseNumber(
+                    std::string_view(argument).substr(std::string("--key-bits=").size()),
+                    &options->key_bits);
+        } else if (argument.rfind("--fingerprint-fpr=", 0) == 0) {
+            valid = ParseNumber(
+                    std::string_view(argument).substr(std::string("--fingerprint-fpr=").size()),
+                    &options->fingerprint_fpr);
+        } else if (argument.rfind("--key-file=", 0) == 0) {
+            options->key_file_path = argument.substr(std::string("--key-file=").size());
+        } else if (argument == "--prefilter") {
+            options->prefilter = true;
+        } else if (argument == "--string-keys") {
+            options->string_keys = true;
+        } else if (argument == "--pipeline") {
+            options->pipeline = true;
+        } else if (argument.rfind("--interleave=", 0) == 0) {
+            valid = ParseNumber(
+                    std::string_view(argument).substr(std::string("--interleave=").size()),
+                    &options->interleave);
+        } else if (argument == "--binary-output") {
+            options->binary_output = true;
+        } else if (argument.rfind("--memory-budget=", 0) == 0) {
+            valid = ParseNumber(
+                    std::string_view(argument).substr(std::string("--memory-budget=").size()),
+                    &options->memory_budget_mb);
+        } else {
+            std::cerr << "Unknown option: " << argument << "\n";
+            return false;
+        }
+        if (!valid) {
+            std::cerr << "Invalid value: " << argument << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename Number>
+bool ParseNumber(std::string_view text, Number *value) {
+    const char *end = text.data() + text.size();
+    auto result = std::from_chars(text.data(), end, *value);
+    return result.ec == std::errc() && result.ptr == end;
+}
+
+template<typename Key, typename KeyHash>
+int ServeQueries(const Options &options) {
+    if (!options.key_file_path.empty() && options.fingerprint_fpr == 0) {
+        std::cerr << "--key-file needs --fingerprint-fpr\n";
+        return 1;
+    }
+    if (options.fingerprint_fpr != 0 && (!options.save_path.empty() ||
+                                         !options.open_path.empty())) {
+        std::cerr << "Fingerprint tables have no images\n";
+        return 1;
+    }
+    if (options.prefilter && (!options.open_path.empty() || options.memory_budget_mb != 0)) {
+        std::cerr << "--prefilter needs a table built in memory\n";
+        return 1;
+    }
+    InputReader input(STDIN_FILENO);
+    ResultWriter output(STDOUT_FILENO, options.binary_output);
+    if (!options.open_path.empty()) {
+        FlatPerfectHashTable<Key, KeyHash, FillerSlots<Key>> static_hash_table;
+        if (!static_hash_table.Open(options.open_path)) {
+            std::cerr << "Cannot open table image: " << options.open_path << "\n";
+            return 1;
+        }
+        AnswerQueries<Key>(input, static_hash_table, options, output);
+        return CheckErrors(input, output);
+    }
+    if (options.memory_budget_mb != 0) {
+        if (options.save_path.empty()) {
+            std::cerr << "--memory-budget needs --save\n";
+            return 1;
+        }
+        FlatPerfectHashTable<Key, KeyHash, FillerSlots<Key>> static_hash_table;
+        static_hash_table.SetBuildThreads(std::thread::hardware_concurrency());
+        size_t size = 0;
+        input.ReadRequiredInteger(&size);
+        auto next_key = [&](Key *key) {
+            if (size == 0 || !input.ReadRequiredInteger(key)) {
+                return false;
+            }
+            --size;
+            return true;
+        };
+        if (!static_hash_table.BuildImage(next_key, options.save_path,
+                                          options.memory_budget_mb << 20)) {
+            std::cerr << "Cannot save table image: " << options.save_path << "\n";
+            return 1;
+        }
+        if (input.HasError()) {
+            return CheckErrors(input, output);
+        }
+        AnswerQueries<Key>(input, static_hash_table, options, output);
+        return CheckErrors(input, output);
+    }
+
+    auto data = ReadVector<Key>(input);
+    if (input.HasError()) {
+        return CheckErrors(input, output);
+    }
+    if (options.fingerprint_fpr != 0) {
+        if (options.fingerprint_fpr >= FingerprintSlots<Key, uint8_t>::kFalsePositiveRate) {
+            return ServeFingerprintQueries<Key, KeyHash, uint8_t>(data, input, options, output);
+        }
+        if (options.fingerprint_fpr >= FingerprintSlots<Key, uint16_t>::kFalsePositiveRate) {
+            return ServeFingerprintQueries<Key, KeyHash, uint16_t>(data, input, options, output);
+        }
+        std::cerr << "No fingerprint is wide enough for false positive rate "
+                  << options.fingerprint_fpr << "\n";
+        return 1;
+    }
+    bool saved;
+    if (options.engine == "fks") {
+        saved = BuildAndOperateQueries<FlatPerfectHashTable<Key, KeyHash, FillerSlots<Key>>>(
+                data, input, options, output);
+    } else if (options.engine == "mphf") {
+        saved = BuildAndOperateQueries<MinimalPerfectHashTable<Key, KeyHash>>(
+                data, input, options, output);
+    } else if (options.engine == "bbhash") {
+        saved = BuildAndOperateQueries<BBHashTable<Key, MixHash>>(
+                data, input, options, output);
+    } else if (options.engine == "blocked") {
+        saved = BuildAndOperateQueries<BlockedHashTable<Key, KeyHash>>(
+                data, input, options, output);
+    } else if (options.engine == "fuse") {
+        saved = BuildAndOperateQueries<BinaryFuseFilter<Key, MixHash>>(
+                data, input, options, output);
+    } else {
+        std::cerr << "Unknown engine: " << options.engine << "\n";
+        return 1;
+    }
+    return saved ? CheckErrors(input, output) : 1;
+}
+
+template<typename Key, typename KeyHash, typename Fingerprint>
+int ServeFingerprintQueries(const std::vector<Key> &data, InputReader &input,
+                            const Options &options, ResultWriter &output) {
+    using Slots = FingerprintSlots<Key, Fingerprint>;
+    bool built;
+    if (options.engine == "fks") {
+        built = BuildAndOperateQueries<FlatPerfectHashTable<Key, KeyHash, Slots>>(
+                data, input, options, output);
+    } else if (options.engine == "mphf") {
+        built = BuildAndOperateQueries<MinimalPerfectHashTable<Key, KeyHash, Slots>>(
+                data, input, options, output);
+    } else {
+        std::cerr << "--fingerprint-fpr supports --engine=fks and --engine=mphf\n";
+        return 1;
+    }
+    return built ? CheckErrors(input, output) : 1;
+}
+
+int ServeStringQueries(const Options &options) {
+    if (options.engine != "fks" || !options.save_path.empty() || !options.open_path.empty() ||
+        options.memory_budget_mb != 0 || options.pipeline || options.fingerprint_fpr != 0 ||
+        !options.key_file_path.empty()) {
+        std::cerr << "--string-keys supports --engine=fks without images, fingerprints or "
+                     "--pipeline\n";
+        return 1;
+    }
+    InputReader input(STDIN_FILENO);
+    ResultWriter output(STDOUT_FILENO, options.binary_output);
+    // The tokens of a vector are kept in one buffer and viewed in place.
+    auto read_strings = [&](std::string *buffer) {
+        size_t size = 0;
+        input.ReadRequiredInteger(&size);
+        std::vector<size_t> ends;
+        std::string token;
+        for (size_t i = 0; i < size && input.ReadRequiredToken(&token); ++i) {
+            buffer->append(token);
+            ends.push_back(buffer->size());
+        }
+        std::vector<std::string_view> strings;
+        size_t begin = 0;
+        for (auto end : ends) {
+            strings.emplace_back(buffer->data() + begin, end - begin);
+            begin = end;
+        }
+        return strings;
+    };
+    std::string data_buffer;
+    auto data = read_strings(&data_buffer);
+    if (input.HasError()) {
+        return CheckErrors(input, output);
+    }
+    // Longer keys do not fit an ArenaSlots slot; longer queries just miss.
+    if (std::any_of(data.begin(), data.end(),
+                    [](std::string_view key) { return key.size() > ArenaSlots::kMaxLength; })) {
+        std::cerr << "String keys are limited to " << ArenaSlots::kMaxLength << " bytes\n";
+        return 1;
+    }
+    StringFixedSet static_hash_table;
+    static_hash_table.SetBuildThreads(std::thread::hardware_concurrency());
+    static_hash_table.SetPrefilter(options.prefilter);
+    static_hash_table.Initialize(data);
+    data = std::vector<std::string_view>();
+    data_buffer = std::string();
+    std::string queries_buffer;
+    OperateQueries(read_strings(&queries_buffer), static_hash_table, output,
+                   options.query_threads, options.interleave);
+    return CheckErrors(input, output);
+}
+
+template<typename HashTable, typename Key>
+bool BuildAndOperateQueries(const std::vector<Key> &data, InputReader &input,
+                            const Options &options, ResultWriter &output) {
+    HashTable static_hash_table;
+    static_hash_table.SetBuildThreads(std::thread::hardware_concurrency());
+    if constexpr (requires { static_hash_table.SetKeyFile(options.key_file_path); }) {
+        static_hash_table.SetKeyFile(options.key_file_path);
+    }
+    if constexpr (requires { static_hash_table.SetPrefilter(options.prefilter); }) {
+        static_hash_table.SetPrefilter(options.prefilter);
+    } else if (options.prefilter) {
+        std::cerr << "--prefilter is not supported by --engine=" << options.engine << "\n";
+        return false;
+    }
+    if constexpr (!requires(Key key) { static_hash_table.ContainsAsync(key); }) {
+        if (options.interleave != 0) {
+            std::cerr << "--interleave is not supported by --engine=" << options.engine << "\n";
+            return false;
+        }
+    }
+    static_hash_table.Initialize(data);
+    if constexpr (requires { static_hash_table.IsVerified(); }) {
+        if (!options.key_file_path.empty() && !static_hash_table.IsVerified()) {
+            std::cerr << "Cannot write key file: " << options.key_file_path << "\n";
+            return false;
+        }
+    }
+    if (!options.save_path.empty()) {
+        bool saved = false;
+        if constexpr (requires { static_hash_table.Save(options.save_path); }) {
+            saved = static_hash_table.Save(options.save_path);
+        }
+        if (!saved) {
+            std::cerr << "Cannot save table image: " << options.save_path << "\n";
+            return false;
+        }
+    }
+    AnswerQueries<Key>(input, static_hash_table, options, output);
+    return true;
+}
+
+template<typename Key, typename HashTable>
+void AnswerQueries(InputReader &input, const HashTable &static_hash_table,
+                   const Options &options, ResultWriter &output) {
+    if (options.pipeline) {
+        PipelineQueries<Key>(input, static_hash_table, output, options.query_threads,
+                             options.interleave);
+    } else {
+        OperateQueries(ReadVector<Key>(input), static_hash_table, output,
+                       options.query_threads, options.interleave);
+    }
+}
+
+template<typename Item>
+bool BoundedQueue<Item>::Push(Item item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock, [&] { return closed_ || items_.size() < capacity_; });
+    if (closed_) {
+        return false;
+    }
+    items_.push_back(std::move(item));
+    not_empty_.notify_one();
+    return true;
+}
+
+template<typename Item>
+bool BoundedQueue<Item>::Pop(Item *item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return closed_ || !items_.empty(); });
+    if (items_.empty()) {
+        return false;
+    }
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+}
+
+template<typename Item>
+void BoundedQueue<Item>::Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+}
+
+template<typename Body>
+void ParallelFor(size_t count, size_t threads, Body body) {
+    threads = std::max<size_t>(std::min(threads, count), 1);
+    if (threads == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            body(0, i);
+        }
+        return;
+    }
+
+    struct Range {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+    std::vector<Range> ranges(threads);
+    for (size_t worker = 0; worker < threads; ++worker) {
+        ranges[worker].begin = count * worker / threads;
+        ranges[worker].end = count * (worker + 1) / threads;
+    }
+
+    auto steal = [&](size_t thief) {
+        for (size_t shift = 1; shift < threads; ++shift) {
+            auto &victim = ranges[(thief + shift) % threads];
+            size_t begin, end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.begin == victim.end) {
+                    continue;
+                }
+                begin = victim.begin + (victim.end - victim.begin) / 2;
+                end = victim.end;
+                victim.end = begin;
+            }
+            std::lock_guard<std::mutex> lock(ranges[thief].mutex);
+            ranges[thief].begin = begin;
+            ranges[thief].end = end;
+            return true;
+        }
+        return false;
+    };
+
+    auto work = [&](size_t worker) {
+        const size_t kGrain = 64;
+        while (true) {
+            size_t begin, end;
+            {
+                std::lock_guard<std::mutex> lock(ranges[worker].mutex);
+                begin = ranges[worker].begin;
+                end = std::min(begin + kGrain, ranges[worker].end);
+                ranges[worker].begin = end;
+            }
+            if (begin == end) {
+                if (!steal(worker)) {
+                    return;
+                }
+                continue;
+            }
+            for (size_t i = begin; i < end; ++i) {
+                body(worker, i);
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t worker = 1; worker < threads; ++worker) {
+        workers.emplace_back(work, worker);
+    }
+    work(0);
+    for (auto &thread : workers) {
+        thread.join();
+    }
+}
+
+template<typename HashTable, typename Key>
+void AnswerBlock(const HashTable &static_hash_table, std::span<const Key> keys,
+                 std::span<uint8_t> out, size_t interleave) {
+    if constexpr (requires(Key key) { static_hash_table.ContainsAsync(key); }) {
+        if (interleave != 0) {
+            InterleaveLookups(keys, interleave,
+                              [&](const Key &key) { return static_hash_table.ContainsAsync(key); },
+                              [&](size_t i, bool found) { out[i] = found; });
+            return;
+        }
+    }
+    if constexpr (requires { static_hash_table.ContainsBatch(keys, out); }) {
+        static_hash_table.ContainsBatch(keys, out);
+    } else {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            out[i] = static_hash_table.Contains(keys[i]);
+        }
+    }
+}
+
+template<typename HashTable, typename Key>
+void OperateQueries(const std::vector<Key> &queries, const HashTable &static_hash_table,
+                    ResultWriter &output, size_t threads, size_t interleave) {
+    // Queries go in blocks of kBlockSize. threads workers, started once,
+    // claim blocks in order and both answer them and format the answers,
+    // each block into a slot of its own. This thread only copies the slots
+    // to output in query order, so the output does not depend on threads.
+    // Workers stay at most kBlocksPerThread blocks each ahead of it, which
+    // bounds the slots. RunLookupBenchmark times this for 1 thread up to
+    // hardware_concurrency.
+    const size_t kBlockSize = 4096;
+    const size_t kBlocksPerThread = 16;
+    threads = std::max<size_t>(threads, 1);
+    struct Slot {
+        std::vector<uint8_t> found;
+        std::vector<char> bytes;
+        bool ready = false;
+    };
+    size_t blocks = (queries.size() + kBlockSize - 1) / kBlockSize;
+    std::vector<Slot> slots(std::min(blocks, threads * kBlocksPerThread));
+    std::mutex mutex;
+    std::condition_variable claimable;
+    std::condition_variable answered;
+    size_t next_block = 0;
+    size_t written_blocks = 0;
+
+    auto work = [&] {
+        while (true) {
+            size_t block;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                claimable.wait(lock, [&] {
+                    return next_block == blocks || next_block < written_blocks + slots.size();
+                });
+                if (next_block == blocks) {
+                    return;
+                }
+                block = next_block++;
+            }
+            size_t begin = block * kBlockSize;
+            size_t size = std::min(kBlockSize, queries.size() - begin);
+            auto &slot = slots[block % slots.size()];
+            slot.found.resize(size);
+            AnswerBlock(static_hash_table, std::span<const Key>(queries).subspan(begin, size),
+                        std::span<uint8_t>(slot.found), interleave);
+            slot.bytes.resize(output.MaxFormattedSize(size));
+            slot.bytes.resize(output.Format(slot.found, slot.bytes.data()));
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.ready = true;
+            }
+            answered.notify_one();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t worker = 0; worker < threads; ++worker) {
+        workers.emplace_back(work);
+    }
+    for (size_t block = 0; block < blocks; ++block) {
+        auto &slot = slots[block % slots.size()];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            answered.wait(lock, [&] { return slot.ready; });
+        }
+        output.Write(slot.bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.ready = false;
+            ++written_blocks;
+        }
+        claimable.notify_all();
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    output.Flush();
+}
+
+template<typename Key, typename HashTable>
+void PipelineQueries(InputReader &input, const HashTable &static_hash_table,
+                     ResultWriter &output, size_t threads, size_t interleave) {
+    const size_t kBlockSize = 4096;
+    const size_t kChunksPerThread = 4;
+    threads = std::max<size_t>(threads, 1);
+    struct Chunk {
+        size_t index = 0;
+        std::vector<Key> keys;
+        std::vector<uint8_t> found;
+        std::vector<char> bytes;
+    };
+    std::vector<Chunk> chunks((threads + 2) * kChunksPerThread);
+    BoundedQueue<Chunk *> free_chunks(chunks.size());
+    BoundedQueue<Chunk *> read_chunks(chunks.size());
+    BoundedQueue<Chunk *> answered_chunks(chunks.size());
+    for (auto &chunk : chunks) {
+        free_chunks.Push(&chunk);
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t worker = 0; worker < threads; ++worker) {
+        workers.emplace_back([&] {
+            Chunk *chunk;
+            while (read_chunks.Pop(&chunk)) {
+                chunk->found.resize(chunk->keys.size());
+                AnswerBlock(static_hash_table, std::span<const Key>(chunk->keys),
+                            std::span<uint8_t>(chunk->found), interleave);
+                chunk->bytes.resize(output.MaxFormattedSize(chunk->found.size()));
+                chunk->bytes.resize(output.Format(chunk->found, chunk->bytes.data()));
+                answered_chunks.Push(chunk);
+            }
+        });
+    }
+    // At most chunks.size() consecutive chunks are in flight, so index
+    // modulo that is a free place to park one that arrives early.
+    std::thread writer([&] {
+        std::vector<Chunk *> early(chunks.size(), nullptr);
+        size_t next = 0;
+        Chunk *chunk;
+        while (answered_chunks.Pop(&chunk)) {
+            early[chunk->index % early.size()] = chunk;
+            while (early[next % early.size()] != nullptr) {
+                auto &ready = early[next % early.size()];
+                output.Write(ready->bytes);
+                free_chunks.Push(ready);
+                ready = nullptr;
+                ++next;
+            }
+        }
+    });
+
+    size_t queries = 0;
+    input.ReadRequiredInteger(&queries);
+    // A short or malformed input ends the queries at the first value that
+    // is not there.
+    bool complete = true;
+    for (size_t index = 0, begin = 0; begin < queries && complete; ++index) {
+        Chunk *chunk;
+        free_chunks.Pop(&chunk);
+        chunk->index = index;
+        chunk->keys.resize(std::min(kBlockSize, queries - begin));
+        for (size_t i = 0; i < chunk->keys.size(); ++i) {
+            if (!input.ReadRequiredInteger(&chunk->keys[i])) {
+                chunk->keys.resize(i);
+                complete = false;
+                break;
+            }
+        }
+        begin += chunk->keys.size();
+        read_chunks.Push(chunk);
+    }
+    read_chunks.Close();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    answered_chunks.Close();
+    writer.join();
+    output.Flush();
+}
+
+// Frames of every LookupTask coroutine have the same few sizes, so freed
+// frames up to kFrameSize bytes are kept for reuse by the same thread.
+static const size_t kFrameSize = 256;
+
+struct FramePool : std::vector<void *> {
+    ~FramePool() {
+        for (auto frame : *this) {
+            ::operator delete(frame);
+        }
+    }
+};
+
+static thread_local FramePool free_frames;
+
+void *LookupTask::promise_type::operator new(size_t size) {
+    if (size > kFrameSize) {
+        return ::operator new(size);
+    }
+    if (free_frames.empty()) {
+        return ::operator new(kFrameSize);
+    }
+    void *frame = free_frames.back();
+    free_frames.pop_back();
+    return frame;
+}
+
+void LookupTask::promise_type::operator delete(void *frame, size_t size) {
+    if (size > kFrameSize) {
+        ::operator delete(frame);
+        return;
+    }
+    free_frames.push_back(frame);
+}
+
+LookupTask::LookupTask(LookupTask &&other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)) {}
+
+LookupTask &LookupTask::operator=(LookupTask &&other) noexcept {
+    if (this != &other) {
+        if (handle_) {
+            handle_.destroy();
+        }
+        handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+}
+
+LookupTask::~LookupTask() {
+    if (handle_) {
+        handle_.destroy();
+    }
+}
+
+void LookupTask::Resume() {
+    handle_.resume();
+}
+
+bool LookupTask::Done() const {
+    return handle_.done();
+}
+
+bool LookupTask::Result() const {
+    return handle_.promise().result;
+}
+
+template<typename T, typename Lookup, typename Consume>
+void InterleaveLookups(std::span<const T> keys, size_t width, Lookup lookup, Consume consume) {
+    width = std::max<size_t>(std::min(width, keys.size()), 1);
+    std::vector<LookupTask> tasks(width);
+    std::vector<size_t> indices(width);
+    size_t next = 0;
+    for (; next < width && next < keys.size(); ++next) {
+        tasks[next] = lookup(keys[next]);
+        indices[next] = next;
+    }
+    size_t active = next;
+    while (active > 0) {
+        for (size_t slot = 0; slot < width; ++slot) {
+            auto &task = tasks[slot];
+            if (indices[slot] == keys.size()) {
+                continue;
+            }
+            if (!task.Done()) {
+                task.Resume();
+                continue;
+            }
+            consume(indices[slot], task.Result());
+            if (next < keys.size()) {
+                task = lookup(keys[next]);
+                indices[slot] = next++;
+            } else {
+                task = LookupTask();
+                indices[slot] = keys.size();
+                --active;
+            }
+        }
+    }
+}
+
+template<typename Derived, typename T, typename Hash>
+void FixedSetBase<Derived, T, Hash>::Initialize(std::span<const T> data, uint64_t seed) {
+    Self().InitBufferAndSize(data.size());
+    SplitMix64 random_generator(seed);
+    // With at most one key nothing can collide, so skip the search.
+    hash_ = data.size() > 1 ? Hash(random_generator) : Hash();
+    while (!Self().TryFillingHashTable(data)) {
+        hash_ = Hash(random_generator);
+    }
+    if (prefilter_) {
+        SplitMix64 prefilter_generator(kPrefilterHashSeed ^ seed);
+        prefilter_->hash = Hash(prefilter_generator);
+        prefilter_->filter.Reset(data.size());
+        for (const auto &value : data) {
+            prefilter_->filter.Insert(CalcPrefilterHash(value));
+        }
+    }
+    is_initialized_ = true;
+}
+
+template<typename Derived, typename T, typename Hash>
+bool FixedSetBase<Derived, T, Hash>::Contains(const T &value) const {
+    assert(is_initialized_);
+    if (inner_data_size_ == 0) {
+        return false;
+    }
+    if (prefilter_ && !prefilter_->filter.MayContain(CalcPrefilterHash(value))) {
+        return false;
+    }
+    return Self().HasKey(value);
+}
+
+template<typename Derived, typename T, typename Hash>
+void FixedSetBase<Derived, T, Hash>::SetBuildThreads(size_t threads) {
+    build_threads_ = std::max<size_t>(threads, 1);
+}
+
+template<typename Derived, typename T, typename Hash>
+size_t FixedSetBase<Derived, T, Hash>::CalcInnerPosition(const T &value) const {
+    return hash_(value, inner_data_size_);
+}
+
+template<typename Derived, typename T, typename Hash>
+const Hash &FixedSetBase<Derived, T, Hash>::GetHash() const {
+    return hash_;
+}
+
+template<typename Derived, typename T, typename Hash>
+void FixedSetBase<Derived, T, Hash>::Restore(const Hash &hash, size_t inner_data_size) {
+    hash_ = hash;
+    inner_data_size_ = inner_data_size;
+    prefilter_.reset();
+    is_initialized_ = true;
+}
+
+template<typename Derived, typename T, typename Hash>
+void FixedSetBase<Derived, T, Hash>::SetPrefilter(bool enabled) {
+    if (!enabled) {
+        prefilter_.reset();
+    } else if (!prefilter_) {
+        prefilter_ = std::make_unique<Prefilter>();
+    }
+}
+
+template<typename Derived, typename T, typename Hash>
+const BlockedBloomFilter *FixedSetBase<Derived, T, Hash>::GetPrefilter() const {
+    return prefilter_ ? &prefilter_->filter : nullptr;
+}
+
+template<typename Derived, typename T, typename Hash>
+uint64_t FixedSetBase<Derived, T, Hash>::CalcPrefilterHash(const T &value) const {
+    // Spread whatever width the hash has over 64 bits: the filter takes
+    // its block from the high bits and its mask from the low 32.
+    return MixBits(static_cast<uint64_t>(prefilter_->hash(value)));
+}
+
+template<typename Derived, typename T, typename Hash>
+Derived &FixedSetBase<Derived, T, Hash>::Self() {
+    return static_cast<Derived &>(*this);
+}
+
+template<typename Derived, typename T, typename Hash>
+const Derived &FixedSetBase<Derived, T, Hash>::Self() const {
+    return static_cast<const Derived &>(*this);
+}
+
+template<typename Derived, typename T, typename Hash>
+std::vector<size_t> FixedSetBase<Derived, T, Hash>::CalcDistribution(
+        std::span<const T> data) {
+    std::vector<size_t> baskets(inner_data_size_, 0);
+    for (auto value : data) {
+        ++baskets[CalcInnerPosition(value)];
+    }
+    return baskets;
+}
+
+template<typename Derived, typename T, typename Hash>
+std::vector<T> FixedSetBase<Derived, T, Hash>::PartitionByPosition(
+        std::span<const T> data, const std::vector<size_t> &distribution,
+        std::vector<size_t> *starts) const {
+    starts->resize(distribution.size() + 1);
+    size_t end = 0;
+    for (size_t i = 0; i < distribution.size(); ++i) {
+        end += distribution[i];
+        (*starts)[i] = end;
+    }
+    (*starts)[distribution.size()] = end;
+    std::vector<T> partitioned(data.size());
+    for (size_t i = data.size(); i > 0; --i) {
+        partitioned[--(*starts)[CalcInnerPosition(data[i - 1])]] = data[i - 1];
+    }
+    return partitioned;
+}
+
+template<typename T, typename Hash, typename Slots, Dispatch dispatch>
+void PerfectHashFirstLevelHashTable<T, Hash, Slots, dispatch>::InitBufferAndSize(size_t size) {
+    this->inner_data_size_ = size * size;
+    inner_data_.Reset(this->inner_data_size_);
+}
+
+template<typename T, typename Hash, typename Slots, Dispatch dispatch>
+bool PerfectHashFirstLevelHashTable<T, Hash, Slots, dispatch>::HasKey(const T &value) const {
+    return inner_data_.Matches(this->CalcInnerPosition(value), value);
+}
+
+template<typename T, typename Hash, typename Slots, Dispatch dispatch>
+bool PerfectHashFirstLevelHashTable<T, Hash, Slots, dispatch>::TryFillingHashTable(
+        std::span<const T> data) {
+    auto distribution = this->CalcDistribution(data);
+    for (auto num : distribution) {
+        if (num > 1) {
+            return false;
+        }
+    }
+    for (auto value: data) {
+        inner_data_.Assign(this->CalcInnerPosition(value), value);
+    }
+    inner_data_.Seal();
+    return true;
+}
+
+
+template<typename T, typename Hash, typename Slots, Dispatch dispatch>
+void PerfectHashFirstLevelHashTable<T, Hash, Slots, dispatch>::Prefetch(const T &value) const {
+    if (this->inner_data_size_ != 0) {
+        inner_data_.Prefetch(this->CalcInnerPosition(value));
+    }
+}
+
+template<typename T, typename Hash, typename Slots, Dispatch dispatch>
+LookupTask PerfectHashTable<T, Hash, Slots, dispatch>::ContainsAsync(T value) const {
+    if (this->inner_data_size_ == 0) {
+        co_return false;
+    }
+    if (const auto *prefilter = this->GetPrefilter()) {
+        uint64_t prefilter_hash = this->CalcPrefilterHash(value);
+        prefilter->Prefetch(prefilter_hash);
+        co_await std::suspend_always();
+        if (!prefilter->MayContain(prefilter_hash)) {
+            co_return false;
+        }
+    }
+    const auto &bucket = hashTable_[this->CalcInnerPosition(value)];
+    // The bucket object spans several lines, all of which Prefetch and
+    // Contains read.
+    const char *bucket_bytes = reinterpret_cast<const char *>(&bucket);
+    for (size_t line = 0; line < sizeof(bucket); line += 64) {
+        __builtin_prefetch(bucket_bytes + line);
+    }
+    co_await std::suspend_always();
+    bucket.Prefetch(value);
+    co_await std::suspend_always();
+    co_return bucket.Contains(value);
+}
+
+template<typename T, typename Hash, typename Slots, Dispatch dispatch>
+void PerfectHashTable<T, Hash, Slots, dispatch>::InitBufferAndSize(size_t size) {
+    this->inner_data_size_ = size;
+    hashTable_.resize(this->inner_data_size_);
+}
+
+template<typename T, typename Hash, typename Slots, Dispatch dispatch>
+bool PerfectHashTable<T, Hash, Slots, dispatch>::HasKey(const T &value) const {
+    return hashTable_[this->CalcInnerPosition(value)].Contains(value);
+}
+
+template<typename T, typename Hash, typename Slots, Dispatch dispatch>
+bool PerfectHashTable<T, Hash, Slots, dispatch>::TryFillingHashTable(std::span<const T> data) {
+    auto distribution = this->CalcDistribution(data);
+    size_t sum_size = 0;
+    for (auto &number: distribution) {
+        sum_size += number * number;
+    }
+    if (sum_size > kMemoryRepletionRatio * hashTable_.size()) {
+        return false;
+    } else {
+        assert(distribution.size() == hashTable_.size());
+        std::vector<size_t> starts;
+        auto partitioned = this->PartitionByPosition(data, distribution, &starts);
+
+        ParallelFor(hashTable_.size(), this->build_threads_, [&](size_t, size_t i) {
+            hashTable_[i].Initialize(
+                    std::span<const T>(partitioned).subspan(starts[i], distribution[i]), i);
+        });
+        return true;
+    }
+}
+
+
+template<typename T, typename Hash, typename Slots>
+void FlatPerfectHashTable<T, Hash, Slots>::InitBufferAndSize(size_t size) {
+    this->inner_data_size_ = size;
+    buckets_.resize(this->inner_data_size_);
+    headers_ = buckets_.data();
+}
+
+template<typename T, typename Hash, typename Slots>
+bool FlatPerfectHashTable<T, Hash, Slots>::HasKey(const T &value) const {
+    return slots_.Matches(CalcSlot(headers_[this->CalcInnerPosition(value)], value), value);
+}
+
+template<typename T, typename Hash, typename Slots>
+void FlatPerfectHashTable<T, Hash, Slots>::ContainsBatch(std::span<const T> keys,
+                                                         std::span<uint8_t> out) const {
+    assert(out.size() >= keys.size());
+    if (this->inner_data_size_ == 0) {
+        std::fill(out.begin(), out.begin() + keys.size(), 0);
+        return;
+    }
+    const auto *prefilter = this->GetPrefilter();
+    if constexpr (requires { GetLookupView(); }) {
+        switch (prefilter ? LookupKernel::kScalar : GetLookupKernel()) {
+            case LookupKernel::kAvx512:
+                ContainsBatchAvx512(GetLookupView(), keys, out);
+                return;
+            case LookupKernel::kAvx2:
+                ContainsBatchAvx2(GetLookupView(), keys, out);
+                return;
+            case LookupKernel::kScalar:
+                break;
+        }
+    }
+    size_t indices[kBatchGroupSize];
+    if (!prefilter) {
+        for (size_t begin = 0; begin < keys.size(); begin += kBatchGroupSize) {
+            size_t size = std::min(kBatchGroupSize, keys.size() - begin);
+            std::iota(indices, indices + size, begin);
+            ContainsGroup(keys, std::span<const size_t>(indices, size), out);
+        }
+        return;
+    }
+    // Keys that pass the filter are gathered until they fill a group, so
+    // the groups looked up in the table stay full however rare hits are.
+    uint64_t prefilter_hashes[kBatchGroupSize];
+    size_t count = 0;
+    for (size_t begin = 0; begin < keys.size(); begin += kBatchGroupSize) {
+        size_t size = std::min(kBatchGroupSize, keys.size() - begin);
+        for (size_t i = 0; i < size; ++i) {
+            prefilter_hashes[i] = this->CalcPrefilterHash(keys[begin + i]);
+            prefilter->Prefetch(prefilter_hashes[i]);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            out[begin + i] = 0;
+            if (count == kBatchGroupSize) {
+                ContainsGroup(keys, std::span<const size_t>(indices, count), out);
+                count = 0;
+            }
+            indices[count] = begin + i;
+            count += prefilter->MayContain(prefilter_hashes[i]);
+        }
+    }
+    ContainsGroup(keys, std::span<const size_t>(indices, count), out);
+}
+
+template<typename T, typename Hash, typename Slots>
+LookupTask FlatPerfectHashTable<T, Hash, Slots>::ContainsAsync(T value) const {
+    if (this->inner_data_size_ == 0) {
+        co_return false;
+    }
+    if (const auto *prefilter = this->GetPrefilter()) {
+        uint64_t prefilter_hash = this->CalcPrefilterHash(value);
+        prefilter->Prefetch(prefilter_hash);
+        co_await std::suspend_always();
+        if (!prefilter->MayContain(prefilter_hash)) {
+            co_return false;
+        }
+    }
+    const auto &header = headers_[this->CalcInnerPosition(value)];
+    __builtin_prefetch(&header);
+    co_await std::suspend_always();
+    size_t position = CalcSlot(header, value);
+    slots_.Prefetch(position);
+    co_await std::suspend_always();
+    co_return slots_.Matches(position, value);
+}
+
+template<typename T, typename Hash, typename Slots>
+void FlatPerfectHashTable<T, Hash, Slots>::ContainsGroup(std::span<const T> keys,
+                                                         std::span<const size_t> indices,
+                                                         std::span<uint8_t> out) const {
+    size_t positions[kBatchGroupSize];
+    for (size_t i = 0; i < indices.size(); ++i) {
+        positions[i] = this->CalcInnerPosition(keys[indices[i]]);
+        __builtin_prefetch(&headers_[positions[i]]);
+    }
+    for (size_t i = 0; i < indices.size(); ++i) {
+        const auto &header = headers_[positions[i]];
+        positions[i] = CalcSlot(header, keys[indices[i]]);
+        slots_.Prefetch(positions[i]);
+    }
+    for (size_t i = 0; i < indices.size(); ++i) {
+        out[indices[i]] = slots_.Matches(positions[i], keys[indices[i]]);
+    }
+}
+
+template<typename T, typename Hash, typename Slots>
+FlatLookupView FlatPerfectHashTable<T, Hash, Slots>::GetLookupView() const
+requires std::is_same_v<T, int> && std::is_same_v<Hash, MultiplyShiftHash> &&
+         std::is_same_v<Slots, FillerSlots<int>> {
+    static_assert(sizeof(BucketHeader) == sizeof(uint64_t));
+    assert(this->inner_data_size_ < (uint64_t(1) << 32));
+    FlatLookupView view;
+    view.multiplier = this->GetHash().GetMultiplier();
+    view.adder = this->GetHash().GetAdder();
+    view.buckets_size = this->inner_data_size_;
+    view.headers = headers_;
+    view.slots = slots_.Data();
+    return view;
+}
+
+template<typename T, typename Hash, typename Slots>
+auto FlatPerfectHashTable<T, Hash, Slots>::MakeImageHeader(const Hash &hash,
+                                                           uint64_t buckets_size,
+                                                           uint64_t slots_size) -> ImageHeader {
+    auto align = [](uint64_t offset) {
+        return (offset + kImageAlignment - 1) / kImageAlignment * kImageAlignment;
+    };
+    // Zeroed as a whole: the padding in front of a 16-byte aligned hash
+    // would otherwise carry stack contents into the image.
+    ImageHeader header;
+    std::memset(static_cast<void *>(&header), 0, sizeof(header));
+    std::memcpy(header.magic, kImageMagic, sizeof(kImageMagic));
+    header.key_size = sizeof(T);
+    header.bucket_header_size = sizeof(BucketHeader);
+    header.buckets_size = buckets_size;
+    header.buckets_offset = align(sizeof(ImageHeader));
+    header.slots_size = slots_size;
+    header.slots_offset = align(header.buckets_offset + buckets_size * sizeof(BucketHeader));
+    header.hash = hash;
+    return header;
+}
+
+template<typename T, typename Hash, typename Slots>
+bool FlatPerfectHashTable<T, Hash, Slots>::Save(const std::string &path) const
+requires std::is_same_v<Slots, FillerSlots<T>> {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_copyable_v<Hash>);
+    auto header = MakeImageHeader(this->GetHash(), this->inner_data_size_, slots_.Size());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    uint64_t written = 0;
+    auto write = [&](const void *data, uint64_t size) {
+        out.write(static_cast<const char *>(data), size);
+        written += size;
+    };
+    auto pad = [&](uint64_t offset) {
+        const char kZeros[kImageAlignment] = {};
+        write(kZeros, offset - written);
+    };
+    write(&header, sizeof(header));
+    pad(header.buckets_offset);
+    write(headers_, header.buckets_size * sizeof(BucketHeader));
+    pad(header.slots_offset);
+    write(slots_.Data(), header.slots_size * sizeof(T));
+    out.close();
+    return !out.fail();
+}
+
+template<typename T, typename Hash, typename Slots>
+template<typename KeySource>
+bool FlatPerfectHashTable<T, Hash, Slots>::BuildImage(
+        KeySource next_key, const std::string &path, size_t memory_budget, uint64_t seed)
+requires std::is_same_v<Slots, FillerSlots<T>> {
+    static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_copyable_v<Hash>);
+    const std::string spill_path = path + ".keys";
+    auto partition_path = [&](size_t partition) {
+        return path + ".part" + std::to_string(partition);
+    };
+    auto for_each_key = [](const std::string &file, auto body) {
+        std::ifstream in(file, std::ios::binary);
+        std::vector<T> buffer(kExternalBufferKeys);
+        while (in) {
+            in.read(reinterpret_cast<char *>(buffer.data()), buffer.size() * sizeof(T));
+            size_t count = in.gcount() / sizeof(T);
+            for (size_t i = 0; i < count; ++i) {
+                body(buffer[i]);
+            }
+        }
+        return in.eof() && !in.bad();
+    };
+
+    uint64_t size = 0;
+    {
+        std::ofstream spill(spill_path, std::ios::binary | std::ios::trunc);
+        T key;
+        while (next_key(&key)) {
+            spill.write(reinterpret_cast<const char *>(&key), sizeof(T));
+            ++size;
+        }
+        spill.close();
+        if (spill.fail()) {
+            std::remove(spill_path.c_str());
+            return false;
+        }
+    }
+
+    // First level, as in Initialize. Bucket sizes saturate at 255: such a
+    // bucket alone breaks the size bound at any realistic scale, so the
+    // hash is redrawn.
+    SplitMix64 random_generator(seed);
+    Hash hash = size > 1 ? Hash(random_generator) : Hash();
+    std::vector<uint8_t> counts;
+    uint64_t slots_size;
+    while (true) {
+        counts.assign(size, 0);
+        if (!for_each_key(spill_path, [&](const T &key) {
+                auto &count = counts[hash(key, size)];
+                count += count != UINT8_MAX;
+            })) {
+            std::remove(spill_path.c_str());
+            return false;
+        }
+        slots_size = 0;
+        bool saturated = false;
+        for (auto count : counts) {
+            slots_size += uint64_t(count) * count;
+            saturated |= count == UINT8_MAX;
+        }
+        if (!saturated && slots_size <= kMemoryRepletionRatio * size) {
+            break;
+        }
+        hash = Hash(random_generator);
+    }
+    static_assert(BucketHeader::kMaxKeys >= UINT8_MAX - 1);
+    // Past kOffsetBits of slots the keys alone would take terabytes.
+    if (slots_size > BucketHeader::kMaxOffset) {
+        std::remove(spill_path.c_str());
+        return false;
+    }
+
+    // Partitions are ranges of buckets whose keys, slots and headers fit
+    // the budget together; one bucket always fits.
+    auto bucket_cost = [&](size_t i) {
+        return 2 * counts[i] * sizeof(T) + size_t(counts[i]) * counts[i] * sizeof(T) +
+               sizeof(BucketHeader) + 2 * sizeof(size_t);
+    };
+    std::vector<size_t> partition_begins;
+    size_t used = memory_budget;
+    for (size_t i = 0; i < size; ++i) {
+        if (used + bucket_cost(i) > memory_budget) {
+            partition_begins.push_back(i);
+            used = 0;
+        }
+        used += bucket_cost(i);
+    }
+    size_t partitions = partition_begins.size();
+    partition_begins.push_back(size);
+    auto partition_of = [&](size_t bucket) {
+        return std::upper_bound(partition_begins.begin(), partition_begins.end(), bucket) -
+               partition_begins.begin() - 1;
+    };
+
+    auto remove_files = [&] {
+        std::remove(spill_path.c_str());
+        for (size_t partition = 0; partition < partitions; ++partition) {
+            std::remove(partition_path(partition).c_str());
+        }
+    };
+    for (size_t first = 0; first < partitions; first += kMaxOpenPartitions) {
+        size_t last = std::min(first + kMaxOpenPartitions, partitions);
+        std::vector<std::ofstream> files;
+        for (size_t partition = first; partition < last; ++partition) {
+            files.emplace_back(partition_path(partition), std::ios::binary | std::ios::trunc);
+        }
+        bool read = for_each_key(spill_path, [&](const T &key) {
+            size_t partition = partition_of(hash(key, size));
+            if (partition >= first && partition < last) {
+                files[partition - first].write(reinterpret_cast<const char *>(&key), sizeof(T));
+            }
+        });
+        bool written = true;
+        for (auto &file : files) {
+            file.close();
+            written &= !file.fail();
+        }
+        if (!read || !written) {
+            remove_files();
+            return false;
+        }
+    }
+    std::remove(spill_path.c_str());
+
+    auto header = MakeImageHeader(hash, size, slots_size);
+    std::ofstream image(path, std::ios::binary | std::ios::trunc);
+    image.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    uint64_t slot_offset = 0;
+    std::vector<std::vector<uint8_t>> occupied(this->build_threads_);
+    for (size_t partition = 0; partition < partitions && image; ++partition) {
+        size_t begin = partition_begins[partition];
+        size_t end = partition_begins[partition + 1];
+        std::vector<T> keys;
+        bool read = for_each_key(partition_path(partition), [&](const T &key) {
+            keys.push_back(key);
+        });
+        std::remove(partition_path(partition).c_str());
+        if (!read) {
+            image.setstate(std::ios::failbit);
+            break;
+        }
+
+        std::vector<size_t> starts(end - begin + 1, 0);
+        for (size_t i = begin; i < end; ++i) {
+            starts[i - begin + 1] = starts[i - begin] + counts[i];
+        }
+        std::vector<T> partitioned(keys.size());
+        {
+            std::vector<size_t> next(starts.begin(), starts.end() - 1);
+            for (auto key : keys) {
+                partitioned[next[hash(key, size) - begin]++] = key;
+            }
+        }
+        keys = std::vector<T>();
+        auto bucket_keys = [&](size_t i) {
+            return std::span<const T>(partitioned).subspan(starts[i - begin], counts[i]);
+        };
+
+        std::vector<BucketHeader> headers(end - begin);
+        uint64_t first_slot = slot_offset;
+        for (size_t i = begin; i < end; ++i) {
+            if (counts[i] == 0) {
+                // Slot 0 holds a key of the first non-empty bucket, see
+                // TryFillingHashTable.
+                headers[i - begin] = BucketHeader(0, 1, 0);
+                continue;
+            }
+            headers[i - begin] = BucketHeader(slot_offset, counts[i], 0);
+            slot_offset += headers[i - begin].Size();
+        }
+        std::atomic<bool> searched(true);
+        ParallelFor(end - begin, this->build_threads_, [&](size_t worker, size_t i) {
+            if (!SearchBucketSeed(hash, bucket_keys(begin + i), &headers[i], &occupied[worker])) {
+                searched = false;
+            }
+        });
+        if (!searched) {
+            image.setstate(std::ios::failbit);
+            break;
+        }
+        // Free slots repeat a key of their own bucket, so that no slot of
+        // the partition depends on another one.
+        std::vector<T> slots(slot_offset - first_slot);
+        for (size_t i = begin; i < end; ++i) {
+            const auto &bucket = headers[i - begin];
+            auto keys_of_bucket = bucket_keys(i);
+            if (keys_of_bucket.empty()) {
+                continue;
+            }
+            auto first = slots.begin() + (bucket.Offset() - first_slot);
+            std::fill(first, first + bucket.Size(), keys_of_bucket[0]);
+            for (auto value : keys_of_bucket) {
+                first[CalcBucketSlot(CalcBucketInput(hash, value), bucket.Seed(), bucket.Size())] =
+                        value;
+            }
+        }
+
+        image.seekp(header.buckets_offset + begin * sizeof(BucketHeader));
+        image.write(reinterpret_cast<const char *>(headers.data()),
+                    headers.size() * sizeof(BucketHeader));
+        image.seekp(header.slots_offset + first_slot * sizeof(T));
+        image.write(reinterpret_cast<const char *>(slots.data()), slots.size() * sizeof(T));
+    }
+    image.close();
+    std::error_code error;
+    if (!image.fail()) {
+        // Pads the image when its last sections are empty.
+        std::filesystem::resize_file(path, header.slots_offset + slots_size * sizeof(T), error);
+    }
+    if (image.fail() || error) {
+        remove_files();
+        return false;
+    }
+    return Open(path);
+}
+
+template<typename T, typename Hash, typename Slots>
+bool FlatPerfectHashTable<T, Hash, Slots>::Open(const std::string &path)
+requires std::is_same_v<Slots, FillerSlots<T>> {
+    FileMapping mapping;
+    if (!mapping.Open(path) || mapping.Size() < sizeof(ImageHeader)) {
+        return false;
+    }
+    ImageHeader header;
+    std::memcpy(&header, mapping.Data(), sizeof(header));
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t size) {
+        return offset % kImageAlignment == 0 && offset <= mapping.Size() &&
+               count <= (mapping.Size() - offset) / size;
+    };
+    if (std::memcmp(header.magic, kImageMagic, sizeof(kImageMagic)) != 0 ||
+        header.key_size != sizeof(T) || header.bucket_header_size != sizeof(BucketHeader) ||
+        !fits(header.buckets_offset, header.buckets_size, sizeof(BucketHeader)) ||
+        !fits(header.slots_offset, header.slots_size, sizeof(T))) {
+        return false;
+    }
+    buckets_ = std::vector<BucketHeader>();
+    headers_ = reinterpret_cast<const BucketHeader *>(mapping.Data() + header.buckets_offset);
+    slots_.Attach(std::span<const T>(
+            reinterpret_cast<const T *>(mapping.Data() + header.slots_offset), header.slots_size));
+    mapping_ = std::move(mapping);
+    this->Restore(header.hash, header.buckets_size);
+    return true;
+}
+
+template<typename T, typename Hash, typename Slots>
+void FlatPerfectHashTable<T, Hash, Slots>::SetKeyFile(const std::string &path)
+requires KeyFileSlots<Slots> {
+    slots_.SetKeyFile(path);
+}
+
+template<typename T, typename Hash, typename Slots>
+bool FlatPerfectHashTable<T, Hash, Slots>::IsVerified() const requires KeyFileSlots<Slots> {
+    return slots_.IsVerified();
+}
+
+template<typename T, typename Hash, typename Slots>
+bool FlatPerfectHashTable<T, Hash, Slots>::TryFillingHashTable(std::span<const T> data) {
+    auto distribution = this->CalcDistribution(data);
+    size_t sum_size = 0;
+    bool oversized = false;
+    for (auto &number: distribution) {
+        sum_size += number * number;
+        oversized |= number > BucketHeader::kMaxKeys;
+    }
+    if (oversized || sum_size > kMemoryRepletionRatio * buckets_.size()) {
+        return false;
+    }
+    // Past kOffsetBits of slots the keys alone would take terabytes.
+    assert(sum_size <= BucketHeader::kMaxOffset);
+    slots_.Reset(sum_size);
+    size_t offset = 0;
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+        if (distribution[i] == 0) {
+            // An empty bucket aliases slot 0: whatever is stored there is a
+            // key of the set, so a match can never be a false positive.
+            buckets_[i] = BucketHeader(0, 1, 0);
+            continue;
+        }
+        buckets_[i] = BucketHeader(offset, distribution[i], 0);
+        offset += buckets_[i].Size();
+    }
+
+    std::vector<size_t> starts;
+    auto partitioned = this->PartitionByPosition(data, distribution, &starts);
+    auto bucket_keys = [&](size_t i) {
+        return std::span<const T>(partitioned).subspan(starts[i], distribution[i]);
+    };
+
+    std::vector<std::vector<uint8_t>> occupied(this->build_threads_);
+    std::atomic<bool> searched(true);
+    ParallelFor(buckets_.size(), this->build_threads_, [&](size_t worker, size_t i) {
+        if (!SearchBucketSeed(this->GetHash(), bucket_keys(i), &buckets_[i], &occupied[worker])) {
+            searched = false;
+        }
+    });
+    if (!searched) {
+        return false;
+    }
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+        for (auto value : bucket_keys(i)) {
+            slots_.Assign(CalcSlot(buckets_[i], value), value);
+        }
+    }
+    slots_.Seal();
+    return true;
+}
+
+template<typename T, typename Hash, typename Slots>
+uint64_t FlatPerfectHashTable<T, Hash, Slots>::CalcBucketInput(const Hash &hash, const T &value) {
+    if constexpr (std::is_integral_v<T>) {
+        return static_cast<std::make_unsigned_t<T>>(value);
+    } else {
+        return hash(value);
+    }
+}
+
+template<typename T, typename Hash, typename Slots>
+size_t FlatPerfectHashTable<T, Hash, Slots>::CalcSlot(const BucketHeader &header,
+                                                      const T &value) const {
+    return header.Offset() +
+           CalcBucketSlot(CalcBucketInput(this->GetHash(), value), header.Seed(), header.Size());
+}
+
+template<typename T, typename Hash, typename Slots>
+bool FlatPerfectHashTable<T, Hash, Slots>::SearchBucketSeed(
+        const Hash &hash, std::span<const T> keys, BucketHeader *header,
+        std::vector<uint8_t> *occupied) {
+    if (keys.size() <= 1) {
+        return true;
+    }
+    uint64_t inputs[BucketHeader::kMaxKeys];
+    for (size_t i = 0; i < keys.size(); ++i) {
+        inputs[i] = CalcBucketInput(hash, keys[i]);
+    }
+    for (uint32_t seed = 0; seed <= BucketHeader::kMaxSeed; ++seed) {
+        occupied->assign(header->Size(), 0);
+        bool collision_free = true;
+        for (size_t i = 0; i < keys.size() && collision_free; ++i) {
+            auto &slot = (*occupied)[CalcBucketSlot(inputs[i], seed, header->Size())];
+            collision_free = !slot;
+            slot = 1;
+        }
+        if (collision_free) {
+            *header = BucketHeader(header->Offset(), keys.size(), seed);
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T, typename Hash, typename Slots>
+void MinimalPerfectHashTable<T, Hash, Slots>::SetKeyFile(const std::string &path)
+requires KeyFileSlots<Slots> {
+    slots_.SetKeyFile(path);
+}
+
+template<typename T, typename Hash, typename Slots>
+bool MinimalPerfectHashTable<T, Hash, Slots>::IsVerified() const requires KeyFileSlots<Slots> {
+    return slots_.IsVerified();
+}
+
+template<typename T, typename Hash, typename Slots>
+void MinimalPerfectHashTable<T, Hash, Slots>::InitBufferAndSize(size_t size) {
+    assert(size < (uint64_t(1) << 32));
+    this->inner_data_size_ = (size + kAverageBucketSize - 1) / kAverageBucketSize;
+    pilots_.assign(this->inner_data_size_, 0);
+    keys_size_ = size;
+    slots_size_ = size + size / kSpareSlotsRatio;
+    remap_.assign(slots_size_ - size, 0);
+    // A stream apart from the first-level one, so the two hashes differ.
+    random_generator_ = SplitMix64(kPositionHashSeed);
+}
+
+template<typename T, typename Hash, typename Slots>
+bool MinimalPerfectHashTable<T, Hash, Slots>::HasKey(const T &value) const {
+    auto position = CalcSlot(value, pilots_[this->CalcInnerPosition(value)]);
+    if (position >= keys_size_) {
+        position = remap_[position - keys_size_];
+    }
+    return slots_.Matches(position, value);
+}
 
-    void Initialize(std::vector<T> data);
+template<typename T, typename Hash, typename Slots>
+bool MinimalPerfectHashTable<T, Hash, Slots>::TryFillingHashTable(std::span<const T> data) {
+    auto distribution = this->CalcDistribution(data);
+    std::vector<size_t> starts;
+    auto partitioned = this->PartitionByPosition(data, distribution, &starts);
+    position_hash_ = Hash(random_generator_);
 
-    bool Contains(const T &value) const;
+    // Largest buckets first, while the table is still empty.
+    std::vector<size_t> order(distribution.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t first, size_t second) {
+        return distribution[first] > distribution[second];
+    });
 
-protected:
-    size_t CalcInnerPosition(const T &value) const;
+    std::vector<uint8_t> taken(slots_size_, 0);
+    std::vector<size_t> positions;
+    for (auto bucket : order) {
+        if (distribution[bucket] == 0) {
+            break;
+        }
+        auto keys = std::span<const T>(partitioned).subspan(starts[bucket], distribution[bucket]);
+        bool placed = false;
+        for (uint32_t pilot = 0; pilot <= UINT16_MAX && !placed; ++pilot) {
+            positions.clear();
+            placed = true;
+            for (auto value : keys) {
+                auto position = CalcSlot(value, pilot);
+                if (taken[position]) {
+                    placed = false;
+                    break;
+                }
+                taken[position] = 1;
+                positions.push_back(position);
+            }
+            if (placed) {
+                pilots_[bucket] = pilot;
+            } else {
+                for (auto position : positions) {
+                    taken[position] = 0;
+                }
+            }
+        }
+        if (!placed) {
+            return false;
+        }
+    }
 
-    size_t inner_data_size_;
+    size_t hole = 0;
+    for (size_t position = keys_size_; position < slots_size_; ++position) {
+        if (taken[position]) {
+            while (taken[hole]) {
+                ++hole;
+            }
+            remap_[position - keys_size_] = hole++;
+        }
+    }
+    slots_.Reset(keys_size_);
+    for (auto value : data) {
+        auto position = CalcSlot(value, pilots_[this->CalcInnerPosition(value)]);
+        if (position >= keys_size_) {
+            position = remap_[position - keys_size_];
+        }
+        slots_.Assign(position, value);
+    }
+    slots_.Seal();
+    return true;
+}
 
-    std::vector<size_t> CalcDistribution(const std::vector<T> &data);
+template<typename T, typename Hash, typename Slots>
+size_t MinimalPerfectHashTable<T, Hash, Slots>::CalcSlot(const T &value, uint16_t pilot) const {
+    auto mixed = MixBits(position_hash_(value) ^ (pilot * 0x9e3779b97f4a7c15));
+    return (static_cast<unsigned __int128>(mixed) * slots_size_) >> 64;
+}
 
-private:
-    virtual void InitBufferAndSize(size_t size) = 0;
+LookupKernel DetectLookupKernel() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl")) {
+        return LookupKernel::kAvx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return LookupKernel::kAvx2;
+    }
+    return LookupKernel::kScalar;
+}
 
-    virtual bool TryFillingHashTable(const std::vector<T> &data) = 0;
+bool IsLookupKernelSupported(LookupKernel kernel) {
+    return kernel <= DetectLookupKernel();
+}
 
-    virtual bool HasKey(const T &value) const = 0;
+static LookupKernel lookup_kernel = DetectLookupKernel();
 
-    bool is_initialized_;
-    Hash hash_;
-};
+LookupKernel GetLookupKernel() {
+    return lookup_kernel;
+}
 
-template<typename T, typename Hash>
-class PerfectHashFirstLevelHashTable : public FixedSet<T, Hash> {
-private:
-    std::vector<Optional<T>> inner_data_;
+void SetLookupKernel(LookupKernel kernel) {
+    assert(IsLookupKernelSupported(kernel));
+    lookup_kernel = kernel;
+}
 
-    void InitBufferAndSize(size_t size) final;
+bool ParseLookupKernel(const std::string &name, LookupKernel *kernel) {
+    for (auto candidate : {LookupKernel::kScalar, LookupKernel::kAvx2, LookupKernel::kAvx512}) {
+        if (name == GetLookupKernelName(candidate)) {
+            *kernel = candidate;
+            return true;
+        }
+    }
+    return false;
+}
 
-    bool HasKey(const T &value) const final;
+const char *GetLookupKernelName(LookupKernel kernel) {
+    switch (kernel) {
+        case LookupKernel::kScalar:
+            return "scalar";
+        case LookupKernel::kAvx2:
+            return "avx2";
+        case LookupKernel::kAvx512:
+            return "avx512";
+    }
+    return "unknown";
+}
 
-    bool TryFillingHashTable(const std::vector<T> &data) final;
-};
+FlatBucketHeader::FlatBucketHeader(uint64_t offset, size_t keys, uint32_t seed) {
+    assert(offset <= kMaxOffset && keys <= kMaxKeys && seed <= kMaxSeed);
+    word = offset | uint64_t(keys) << kOffsetBits | uint64_t(seed) << (kOffsetBits + kKeysBits);
+}
 
+uint64_t FlatBucketHeader::Offset() const {
+    return word & kMaxOffset;
+}
 
-template<typename T, typename Hash>
-class PerfectHashTable : public FixedSet<T, Hash> {
-private:
-    std::vector<PerfectHashFirstLevelHashTable<T, Hash>> hashTable_;
+uint64_t FlatBucketHeader::Size() const {
+    uint64_t keys = (word >> kOffsetBits) & kMaxKeys;
+    return keys * keys;
+}
 
-    void InitBufferAndSize(size_t size) final;
+uint32_t FlatBucketHeader::Seed() const {
+    return static_cast<uint32_t>(word >> (kOffsetBits + kKeysBits));
+}
 
-    bool HasKey(const T &value) const final;
+size_t CalcBucketSlot(uint64_t input, uint32_t seed, uint64_t size) {
+    uint64_t mixed = MixBits(input ^ (seed * 0x9e3779b97f4a7c15));
+    return ((mixed >> 32) * size) >> 32;
+}
 
-    bool TryFillingHashTable(const std::vector<T> &data) final;
+bool ContainsScalar(const FlatLookupView &view, int value) {
+    uint64_t bucket_hash = (view.multiplier * static_cast<uint32_t>(value) + view.adder) >> 32;
+    const auto &header = view.headers[(bucket_hash * view.buckets_size) >> 32];
+    return view.slots[header.Offset() + CalcBucketSlot(static_cast<uint32_t>(value),
+                                                       header.Seed(), header.Size())] == value;
+}
 
-    size_t kMemoryRepletionRatio = 4;
-};
+__attribute__((target("avx2")))
+static inline __m256i MultiplyShiftAvx2(__m256i value, __m256i multiplier, __m256i adder) {
+    __m256i low = _mm256_mul_epu32(multiplier, value);
+    __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(multiplier, 32), value);
+    __m256i product = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+    return _mm256_srli_epi64(_mm256_add_epi64(product, adder), 32);
+}
 
-void OperateQueries(const std::vector<int> &queries,
-                    const PerfectHashTable<int, Hash> &static_hash_table);
+__attribute__((target("avx2")))
+static inline __m256i ReduceToRangeAvx2(__m256i hash, __m256i range) {
+    return _mm256_srli_epi64(_mm256_mul_epu32(hash, range), 32);
+}
 
-int main() {
-    std::ios_base::sync_with_stdio(false);
-    std::cin.tie(nullptr);
+// Low 64 bits of a 64x64 product; AVX2 only multiplies 32-bit halves.
+__attribute__((target("avx2")))
+static inline __m256i MultiplyLowAvx2(__m256i left, __m256i right) {
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(left, 32), right),
+                                     _mm256_mul_epu32(left, _mm256_srli_epi64(right, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(left, right), _mm256_slli_epi64(cross, 32));
+}
 
-    auto data = ReadVector(std::cin);
-    auto queries = ReadVector(std::cin);
-    PerfectHashTable<int, Hash> static_hash_table;
-    static_hash_table.Initialize(data);
-    OperateQueries(queries, static_hash_table);
-    return 0;
+__attribute__((target("avx2")))
+static inline __m256i MixBitsAvx2(__m256i value) {
+    value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 30));
+    value = MultiplyLowAvx2(value, _mm256_set1_epi64x(0xbf58476d1ce4e5b9));
+    value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 27));
+    value = MultiplyLowAvx2(value, _mm256_set1_epi64x(0x94d049bb133111eb));
+    return _mm256_xor_si256(value, _mm256_srli_epi64(value, 31));
 }
 
-template<typename T>
-Optional<T> &Optional<T>::operator=(const T &value) {
-    value_ = value;
-    assigned_ = true;
-    return *this;
+// Vector CalcBucketSlot over packed FlatBucketHeader words.
+__attribute__((target("avx2")))
+static inline __m256i CalcSlotAvx2(__m256i input, __m256i header) {
+    const __m256i keys_mask = _mm256_set1_epi64x(FlatBucketHeader::kMaxKeys);
+    __m256i offset = _mm256_and_si256(header, _mm256_set1_epi64x(FlatBucketHeader::kMaxOffset));
+    __m256i keys = _mm256_and_si256(
+            _mm256_srli_epi64(header, FlatBucketHeader::kOffsetBits), keys_mask);
+    __m256i seed = _mm256_srli_epi64(
+            header, FlatBucketHeader::kOffsetBits + FlatBucketHeader::kKeysBits);
+    __m256i mixed = MixBitsAvx2(_mm256_xor_si256(
+            input, MultiplyLowAvx2(seed, _mm256_set1_epi64x(0x9e3779b97f4a7c15))));
+    return _mm256_add_epi64(offset, ReduceToRangeAvx2(_mm256_srli_epi64(mixed, 32),
+                                                      _mm256_mul_epu32(keys, keys)));
 }
 
-template<typename T>
-bool Optional<T>::IsAssigned() const {
-    return assigned_;
+__attribute__((target("avx2")))
+void ContainsBatchAvx2(const FlatLookupView &view, std::span<const int> keys,
+                       std::span<uint8_t> out) {
+    const long long *headers = reinterpret_cast<const long long *>(view.headers);
+    const __m256i multiplier = _mm256_set1_epi64x(view.multiplier);
+    const __m256i adder = _mm256_set1_epi64x(view.adder);
+    const __m256i buckets_size = _mm256_set1_epi64x(view.buckets_size);
+    alignas(32) uint64_t indices[kSimdGroupSize];
+    size_t i = 0;
+    for (; i + kSimdGroupSize <= keys.size(); i += kSimdGroupSize) {
+        auto group = reinterpret_cast<const __m128i *>(keys.data() + i);
+        auto lanes = reinterpret_cast<__m256i *>(indices);
+        for (size_t j = 0; j < kSimdGroupSize / 4; ++j) {
+            __m256i wide = _mm256_cvtepu32_epi64(_mm_loadu_si128(group + j));
+            __m256i bucket = ReduceToRangeAvx2(MultiplyShiftAvx2(wide, multiplier, adder),
+                                               buckets_size);
+            _mm256_store_si256(lanes + j, bucket);
+        }
+        for (auto index : indices) {
+            __builtin_prefetch(view.headers + index);
+        }
+        for (size_t j = 0; j < kSimdGroupSize / 4; ++j) {
+            __m256i wide = _mm256_cvtepu32_epi64(_mm_loadu_si128(group + j));
+            __m256i header = _mm256_i64gather_epi64(headers, _mm256_load_si256(lanes + j), 8);
+            _mm256_store_si256(lanes + j, CalcSlotAvx2(wide, header));
+        }
+        for (auto index : indices) {
+            __builtin_prefetch(view.slots + index);
+        }
+        for (size_t j = 0; j < kSimdGroupSize / 4; ++j) {
+            __m128i key = _mm_loadu_si128(group + j);
+            __m128i slots = _mm256_i64gather_epi32(view.slots, _mm256_load_si256(lanes + j), 4);
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(slots, key)));
+            for (size_t lane = 0; lane < 4; ++lane) {
+                out[i + 4 * j + lane] = mask >> lane & 1;
+            }
+        }
+    }
+    for (; i < keys.size(); ++i) {
+        out[i] = ContainsScalar(view, keys[i]);
+    }
 }
 
-template<typename T>
-T Optional<T>::GetValue() const {
-    assert(assigned_);
-    return value_;
+__attribute__((target("avx512f,avx512vl")))
+static inline __m512i MultiplyShiftAvx512(__m512i value, __m512i multiplier, __m512i adder) {
+    __m512i low = _mm512_mul_epu32(multiplier, value);
+    __m512i high = _mm512_mul_epu32(_mm512_srli_epi64(multiplier, 32), value);
+    __m512i product = _mm512_add_epi64(low, _mm512_slli_epi64(high, 32));
+    return _mm512_srli_epi64(_mm512_add_epi64(product, adder), 32);
 }
 
-Hash::Hash(size_t multiplier_value, size_t adder_value) :
-        multiplier_value(multiplier_value),
-        adder_valuer(adder_value) {}
+__attribute__((target("avx512f,avx512vl")))
+static inline __m512i ReduceToRangeAvx512(__m512i hash, __m512i range) {
+    return _mm512_srli_epi64(_mm512_mul_epu32(hash, range), 32);
+}
 
-size_t Hash::operator()(int value) const {
-    return (value * multiplier_value + adder_valuer) % kPrimeNumber;
+// vpmullq needs AVX512DQ, so the 64-bit product is built from 32-bit halves.
+__attribute__((target("avx512f,avx512vl")))
+static inline __m512i MultiplyLowAvx512(__m512i left, __m512i right) {
+    __m512i cross = _mm512_add_epi64(_mm512_mul_epu32(_mm512_srli_epi64(left, 32), right),
+                                     _mm512_mul_epu32(left, _mm512_srli_epi64(right, 32)));
+    return _mm512_add_epi64(_mm512_mul_epu32(left, right), _mm512_slli_epi64(cross, 32));
 }
 
-std::vector<int> ReadVector(std::istream &in) {
-    size_t size;
-    in >> size;
-    std::vector<int> data(size);
-    for (size_t i = 0; i < size; ++i) {
-        in >> data[i];
-    }
-    return data;
+__attribute__((target("avx512f,avx512vl")))
+static inline __m512i MixBitsAvx512(__m512i value) {
+    value = _mm512_xor_si512(value, _mm512_srli_epi64(value, 30));
+    value = MultiplyLowAvx512(value, _mm512_set1_epi64(0xbf58476d1ce4e5b9));
+    value = _mm512_xor_si512(value, _mm512_srli_epi64(value, 27));
+    value = MultiplyLowAvx512(value, _mm512_set1_epi64(0x94d049bb133111eb));
+    return _mm512_xor_si512(value, _mm512_srli_epi64(value, 31));
 }
 
-void OperateQueries(const std::vector<int> &queries,
-                    const PerfectHashTable<int, Hash> &static_hash_table) {
-    for (auto value: queries) {
-        if (static_hash_table.Contains(value)) {
-            std::cout << "Yes\n";
-        } else {
-            std::cout << "No\n";
+__attribute__((target("avx512f,avx512vl")))
+static inline __m512i CalcSlotAvx512(__m512i input, __m512i header) {
+    const __m512i keys_mask = _mm512_set1_epi64(FlatBucketHeader::kMaxKeys);
+    __m512i offset = _mm512_and_si512(header, _mm512_set1_epi64(FlatBucketHeader::kMaxOffset));
+    __m512i keys = _mm512_and_si512(
+            _mm512_srli_epi64(header, FlatBucketHeader::kOffsetBits), keys_mask);
+    __m512i seed = _mm512_srli_epi64(
+            header, FlatBucketHeader::kOffsetBits + FlatBucketHeader::kKeysBits);
+    __m512i mixed = MixBitsAvx512(_mm512_xor_si512(
+            input, MultiplyLowAvx512(seed, _mm512_set1_epi64(0x9e3779b97f4a7c15))));
+    return _mm512_add_epi64(offset, ReduceToRangeAvx512(_mm512_srli_epi64(mixed, 32),
+                                                        _mm512_mul_epu32(keys, keys)));
+}
+
+__attribute__((target("avx512f,avx512vl")))
+void ContainsBatchAvx512(const FlatLookupView &view, std::span<const int> keys,
+                         std::span<uint8_t> out) {
+    const __m512i multiplier = _mm512_set1_epi64(view.multiplier);
+    const __m512i adder = _mm512_set1_epi64(view.adder);
+    const __m512i buckets_size = _mm512_set1_epi64(view.buckets_size);
+    alignas(64) uint64_t indices[kSimdGroupSize];
+    size_t i = 0;
+    for (; i + kSimdGroupSize <= keys.size(); i += kSimdGroupSize) {
+        auto group = reinterpret_cast<const __m256i *>(keys.data() + i);
+        auto lanes = reinterpret_cast<__m512i *>(indices);
+        for (size_t j = 0; j < kSimdGroupSize / 8; ++j) {
+            __m512i wide = _mm512_cvtepu32_epi64(_mm256_loadu_si256(group + j));
+            __m512i bucket = ReduceToRangeAvx512(MultiplyShiftAvx512(wide, multiplier, adder),
+                                                 buckets_size);
+            _mm512_store_si512(lanes + j, bucket);
+        }
+        for (auto index : indices) {
+            __builtin_prefetch(view.headers + index);
+        }
+        for (size_t j = 0; j < kSimdGroupSize / 8; ++j) {
+            __m512i wide = _mm512_cvtepu32_epi64(_mm256_loadu_si256(group + j));
+            __m512i header = _mm512_i64gather_epi64(_mm512_load_si512(lanes + j), view.headers, 8);
+            _mm512_store_si512(lanes + j, CalcSlotAvx512(wide, header));
+        }
+        for (auto index : indices) {
+            __builtin_prefetch(view.slots + index);
+        }
+        for (size_t j = 0; j < kSimdGroupSize / 8; ++j) {
+            __m256i key = _mm256_loadu_si256(group + j);
+            __m256i slots = _mm512_i64gather_epi32(_mm512_load_si512(lanes + j), view.slots, 4);
+            unsigned mask = _mm256_cmpeq_epi32_mask(slots, key);
+            for (size_t lane = 0; lane < 8; ++lane) {
+                out[i + 8 * j + lane] = mask >> lane & 1;
+            }
         }
     }
+    for (; i < keys.size(); ++i) {
+        out[i] = ContainsScalar(view, keys[i]);
+    }
 }
 
 template<typename T, typename Hash>
-void FixedSet<T, Hash>::Initialize(std::vector<T> data) {
-    InitBufferAndSize(data.size());
-    std::mt19937 random_generator;
-    hash_ = Hash(random_generator);
-    while (!TryFillingHashTable(data)) {
-        hash_ = Hash(random_generator);
+void BBHashFunction<T, Hash>::Build(std::span<const T> keys, size_t threads) {
+    levels_.clear();
+    bits_.clear();
+    fallback_.clear();
+    size_ = keys.size();
+    SplitMix64 random_generator(kLevelHashSeed);
+    std::vector<T> remaining;
+    for (size_t level = 0; level < kMaxLevels && !keys.empty(); ++level) {
+        Level current;
+        current.hash = Hash(random_generator);
+        current.offset = bits_.size() * 64;
+        current.size = (kGamma * keys.size() + 63) / 64 * 64;
+        std::vector<std::atomic<uint64_t>> seen(current.size / 64);
+        std::vector<std::atomic<uint64_t>> collided(current.size / 64);
+        size_t chunks = (keys.size() + kChunkSize - 1) / kChunkSize;
+        auto chunk_keys = [&](size_t chunk) {
+            return keys.subspan(chunk * kChunkSize,
+                                std::min(kChunkSize, keys.size() - chunk * kChunkSize));
+        };
+
+        ParallelFor(chunks, threads, [&](size_t, size_t chunk) {
+            for (auto value : chunk_keys(chunk)) {
+                auto position = current.hash(value, current.size);
+                uint64_t bit = uint64_t(1) << (position % 64);
+                if (seen[position / 64].fetch_or(bit, std::memory_order_relaxed) & bit) {
+                    collided[position / 64].fetch_or(bit, std::memory_order_relaxed);
+                }
+            }
+        });
+        bits_.resize(bits_.size() + current.size / 64);
+        for (size_t word = 0; word < current.size / 64; ++word) {
+            bits_[current.offset / 64 + word] = seen[word].load(std::memory_order_relaxed) &
+                                                ~collided[word].load(std::memory_order_relaxed);
+        }
+        levels_.push_back(current);
+
+        // Colliding keys move to the next level in input order, whatever
+        // the number of threads.
+        std::vector<std::vector<T>> chunk_remaining(chunks);
+        ParallelFor(chunks, threads, [&](size_t, size_t chunk) {
+            for (auto value : chunk_keys(chunk)) {
+                auto position = current.hash(value, current.size);
+                if (collided[position / 64].load(std::memory_order_relaxed) >> (position % 64) & 1) {
+                    chunk_remaining[chunk].push_back(value);
+                }
+            }
+        });
+        std::vector<T> next;
+        for (auto &part : chunk_remaining) {
+            next.insert(next.end(), part.begin(), part.end());
+        }
+        remaining.swap(next);
+        keys = remaining;
     }
-    is_initialized_ = true;
+    fallback_.assign(keys.begin(), keys.end());
+    std::sort(fallback_.begin(), fallback_.end());
+
+    ranks_.assign(bits_.size() / kRankBlockWords + 1, 0);
+    size_t rank = 0;
+    for (size_t word = 0; word < bits_.size(); ++word) {
+        if (word % kRankBlockWords == 0) {
+            ranks_[word / kRankBlockWords] = rank;
+        }
+        rank += std::popcount(bits_[word]);
+    }
+    assert(rank + fallback_.size() == size_);
 }
 
 template<typename T, typename Hash>
-bool FixedSet<T, Hash>::Contains(const T &value) const {
-    assert(is_initialized_);
-    if (inner_data_size_ == 0) {
-        return false;
+size_t BBHashFunction<T, Hash>::Lookup(const T &value) const {
+    for (const auto &level : levels_) {
+        auto position = level.offset + level.hash(value, level.size);
+        if (bits_[position / 64] >> (position % 64) & 1) {
+            return Rank(position);
+        }
     }
-    return HasKey(value);
+    auto found = std::lower_bound(fallback_.begin(), fallback_.end(), value);
+    if (found == fallback_.end() || !(*found == value)) {
+        return kNotFound;
+    }
+    return size_ - fallback_.size() + (found - fallback_.begin());
 }
 
 template<typename T, typename Hash>
-size_t FixedSet<T, Hash>::CalcInnerPosition(const T &value) const {
-    return hash_(value) % inner_data_size_;
+size_t BBHashFunction<T, Hash>::Size() const {
+    return size_;
 }
 
 template<typename T, typename Hash>
-std::vector<size_t> FixedSet<T, Hash>::CalcDistribution(const std::vector<T> &data) {
-    std::vector<size_t> baskets(inner_data_size_, 0);
+size_t BBHashFunction<T, Hash>::Rank(size_t position) const {
+    size_t word = position / 64;
+    size_t block_begin = word / kRankBlockWords * kRankBlockWords;
+    size_t rank = ranks_[word / kRankBlockWords];
+    for (size_t i = block_begin; i < word; ++i) {
+        rank += std::popcount(bits_[i]);
+    }
+    return rank + std::popcount(bits_[word] & ((uint64_t(1) << (position % 64)) - 1));
+}
+
+template<typename T, typename Hash>
+void BBHashTable<T, Hash>::Initialize(std::span<const T> data) {
+    function_.Build(data, build_threads_);
+    keys_.assign(data.size(), T());
     for (auto value : data) {
-        ++baskets[CalcInnerPosition(value)];
+        keys_[function_.Lookup(value)] = value;
     }
-    return baskets;
 }
 
 template<typename T, typename Hash>
-void PerfectHashFirstLevelHashTable<T, Hash>::InitBufferAndSize(size_t size) {
-    this->inner_data_size_ = size * size;
-    inner_data_.resize(this->inner_data_size_);
+bool BBHashTable<T, Hash>::Contains(const T &value) const {
+    auto index = function_.Lookup(value);
+    return index != BBHashFunction<T, Hash>::kNotFound && keys_[index] == value;
 }
 
 template<typename T, typename Hash>
-bool PerfectHashFirstLevelHashTable<T, Hash>::HasKey(const T &value) const {
-    auto optional_value = inner_data_[this->CalcInnerPosition(value)];
-    return optional_value.IsAssigned() && optional_value.GetValue() == value;
+void BBHashTable<T, Hash>::SetBuildThreads(size_t threads) {
+    build_threads_ = std::max<size_t>(threads, 1);
 }
 
 template<typename T, typename Hash>
-bool PerfectHashFirstLevelHashTable<T, Hash>::TryFillingHashTable(
-        const std::vector<T> &data) {
-    auto distribution = this->CalcDistribution(data);
-    for (auto num : distribution) {
-        if (num > 1) {
+void BlockedHashTable<T, Hash>::InitBufferAndSize(size_t size) {
+    // At least one more slot than keys, so some block is never full.
+    this->inner_data_size_ =
+            size == 0 ? 0 : (size * kLoadDenominator / kLoadNumerator) / kBlockSlots + 1;
+    blocks_.resize(this->inner_data_size_);
+}
+
+template<typename T, typename Hash>
+bool BlockedHashTable<T, Hash>::HasKey(const T &value) const {
+    auto block = this->CalcInnerPosition(value);
+    while (true) {
+        if (BlockContains(blocks_[block], value)) {
+            return true;
+        }
+        if (!IsFull(blocks_[block])) {
             return false;
         }
+        block = block + 1 == blocks_.size() ? 0 : block + 1;
     }
-    for (auto value: data) {
-        inner_data_[this->CalcInnerPosition(value)] = value;
+}
+
+template<typename T, typename Hash>
+bool BlockedHashTable<T, Hash>::TryFillingHashTable(std::span<const T> data) {
+    auto distribution = this->CalcDistribution(data);
+    std::vector<size_t> starts;
+    auto partitioned = this->PartitionByPosition(data, distribution, &starts);
+    std::vector<uint8_t> filled(blocks_.size(), 0);
+    size_t block = 0;
+    for (size_t home = 0; home < blocks_.size(); ++home) {
+        if (distribution[home] == 0) {
+            continue;
+        }
+        // Keys arrive in home order, so the spill of earlier homes is
+        // already placed and the cursor never has to move back.
+        if (block < home) {
+            block = home;
+        }
+        for (size_t i = starts[home]; i < starts[home + 1]; ++i) {
+            while (filled[block % blocks_.size()] == kBlockSlots) {
+                ++block;
+            }
+            auto &target = blocks_[block % blocks_.size()];
+            target.keys[filled[block % blocks_.size()]++] = partitioned[i];
+        }
+    }
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        auto filler = filled[i] == 0 ? data[0] : blocks_[i].keys[filled[i] - 1];
+        std::fill(blocks_[i].keys + filled[i], blocks_[i].keys + kBlockSlots, filler);
     }
     return true;
 }
 
+template<typename T, typename Hash>
+bool BlockedHashTable<T, Hash>::IsFull(const Block &block) {
+    return !(block.keys[kBlockSlots - 2] == block.keys[kBlockSlots - 1]);
+}
 
 template<typename T, typename Hash>
-void PerfectHashTable<T, Hash>::InitBufferAndSize(size_t size) {
-    this->inner_data_size_ = size;
-    hashTable_.resize(this->inner_data_size_);
+bool BlockedHashTable<T, Hash>::BlockContains(const Block &block, const T &value) {
+    if constexpr (std::is_same_v<T, int>) {
+        switch (GetLookupKernel()) {
+            case LookupKernel::kAvx512:
+                return BlockContainsAvx512(block.keys, value);
+            case LookupKernel::kAvx2:
+                return BlockContainsAvx2(block.keys, value);
+            case LookupKernel::kScalar:
+                break;
+        }
+    }
+    bool found = false;
+    for (const auto &key : block.keys) {
+        found |= key == value;
+    }
+    return found;
 }
 
 template<typename T, typename Hash>
-bool PerfectHashTable<T, Hash>::HasKey(const T &value) const {
-    return hashTable_[this->CalcInnerPosition(value)].Contains(value);
+void BinaryFuseFilter<T, Hash>::Initialize(std::span<const T> data) {
+    size_ = data.size();
+    segment_length_ = size_ == 0 ? 4 : size_t(1) << static_cast<int>(
+            std::floor(std::log(static_cast<double>(size_)) / std::log(3.33) + 2.25));
+    segment_length_ = std::min(segment_length_, kMaxSegmentLength);
+    // Small sets need relatively more room to peel.
+    double size_factor = size_ <= 1 ? 0 : std::max(
+            1.125, 0.875 + 0.25 * std::log(1e6) / std::log(static_cast<double>(size_)));
+    auto capacity = static_cast<size_t>(std::round(size_ * size_factor));
+    size_t segment_count =
+            std::max((capacity + segment_length_ - 1) / segment_length_, kArity) - (kArity - 1);
+    segment_count_length_ = segment_count * segment_length_;
+    fingerprints_.assign(segment_count_length_ + (kArity - 1) * segment_length_, 0);
+
+    SplitMix64 random_generator(kFilterHashSeed);
+    std::vector<uint64_t> hashes(size_);
+    size_t chunks = (size_ + kChunkSize - 1) / kChunkSize;
+    do {
+        hash_ = Hash(random_generator);
+        ParallelFor(chunks, build_threads_, [&](size_t, size_t chunk) {
+            auto end = std::min(size_, (chunk + 1) * kChunkSize);
+            for (size_t i = chunk * kChunkSize; i < end; ++i) {
+                hashes[i] = hash_(data[i]);
+            }
+        });
+    } while (!TryFillingFingerprints(hashes));
 }
 
 template<typename T, typename Hash>
-bool PerfectHashTable<T, Hash>::TryFillingHashTable(const std::vector<T> &data) {
-    auto distribution = this->CalcDistribution(data);
-    size_t sum_size = 0;
-    for (auto &number: distribution) {
-        sum_size += number * number;
-    }
-    if (sum_size > kMemoryRepletionRatio * hashTable_.size()) {
+bool BinaryFuseFilter<T, Hash>::Contains(const T &value) const {
+    if (size_ == 0) {
         return false;
-    } else {
-        std::vector<std::vector<T>> baskets(hashTable_.size());
-        assert(distribution.size() == hashTable_.size());
-        for (size_t i = 0; i < hashTable_.size(); ++i) {
-            baskets[i].reserve(distribution[i]);
+    }
+    auto hash = hash_(value);
+    size_t positions[kArity];
+    CalcPositions(hash, positions);
+    return CalcFingerprint(hash) ==
+           (fingerprints_[positions[0]] ^ fingerprints_[positions[1]] ^
+            fingerprints_[positions[2]]);
+}
+
+template<typename T, typename Hash>
+void BinaryFuseFilter<T, Hash>::SetBuildThreads(size_t threads) {
+    build_threads_ = std::max<size_t>(threads, 1);
+}
+
+template<typename T, typename Hash>
+void BinaryFuseFilter<T, Hash>::CalcPositions(uint64_t hash, size_t positions[]) const {
+    // The first entry anywhere below segment_count_length_, the others in
+    // the next two segments at offsets taken from other bits of hash.
+    positions[0] = (static_cast<unsigned __int128>(hash) * segment_count_length_) >> 64;
+    positions[1] = (positions[0] + segment_length_) ^ ((hash >> 18) & (segment_length_ - 1));
+    positions[2] = (positions[0] + 2 * segment_length_) ^ (hash & (segment_length_ - 1));
+}
+
+template<typename T, typename Hash>
+uint8_t BinaryFuseFilter<T, Hash>::CalcFingerprint(uint64_t hash) {
+    return static_cast<uint8_t>(hash ^ (hash >> 32));
+}
+
+template<typename T, typename Hash>
+bool BinaryFuseFilter<T, Hash>::TryFillingFingerprints(std::span<const uint64_t> hashes) {
+    // Every entry keeps the number of keys on it and the xor of their
+    // hashes, so the only key of an entry with count 1 is its xor.
+    std::vector<uint32_t> counts(fingerprints_.size(), 0);
+    std::vector<uint64_t> xors(fingerprints_.size(), 0);
+    size_t positions[kArity];
+    for (auto hash : hashes) {
+        CalcPositions(hash, positions);
+        for (auto position : positions) {
+            ++counts[position];
+            xors[position] ^= hash;
+        }
+    }
+    std::vector<size_t> alone;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        if (counts[i] == 1) {
+            alone.push_back(i);
+        }
+    }
+    // Keys in peeling order, each with the entry it was peeled from.
+    std::vector<std::pair<uint64_t, size_t>> peeled;
+    peeled.reserve(hashes.size());
+    while (!alone.empty()) {
+        auto entry = alone.back();
+        alone.pop_back();
+        if (counts[entry] != 1) {
+            continue;
         }
-        for (auto value : data) {
-            baskets[this->CalcInnerPosition(value)].push_back(value);
+        auto hash = xors[entry];
+        peeled.emplace_back(hash, entry);
+        CalcPositions(hash, positions);
+        for (auto position : positions) {
+            xors[position] ^= hash;
+            if (--counts[position] == 1) {
+                alone.push_back(position);
+            }
         }
+    }
+    if (peeled.size() != hashes.size()) {
+        return false;
+    }
+    // In reverse, the entry a key was peeled from is not used by any key
+    // assigned before it, so it can be set to satisfy the key.
+    std::fill(fingerprints_.begin(), fingerprints_.end(), 0);
+    for (auto it = peeled.rbegin(); it != peeled.rend(); ++it) {
+        auto [hash, entry] = *it;
+        CalcPositions(hash, positions);
+        fingerprints_[entry] = CalcFingerprint(hash) ^ fingerprints_[positions[0]] ^
+                               fingerprints_[positions[1]] ^ fingerprints_[positions[2]];
+    }
+    return true;
+}
+
+void BlockedBloomFilter::Reset(size_t size) {
+    blocks_.assign(std::max<size_t>(1, (size * kBitsPerKey + 255) / 256), Block());
+}
+
+void BlockedBloomFilter::Insert(uint64_t hash) {
+    auto &block = blocks_[CalcBlock(hash)];
+    for (size_t i = 0; i < kWords; ++i) {
+        block.words[i] |= uint32_t(1) << ((static_cast<uint32_t>(hash) * kSalts[i]) >> 27);
+    }
+}
+
+void BlockedBloomFilter::Prefetch(uint64_t hash) const {
+    __builtin_prefetch(&blocks_[CalcBlock(hash)]);
+}
+
+bool BlockedBloomFilter::MayContain(uint64_t hash) const {
+    const auto &block = blocks_[CalcBlock(hash)];
+    if (GetLookupKernel() != LookupKernel::kScalar) {
+        return BloomBlockContainsAvx2(block.words, static_cast<uint32_t>(hash));
+    }
+    return BloomBlockContainsScalar(block.words, static_cast<uint32_t>(hash));
+}
+
+size_t BlockedBloomFilter::CalcBlock(uint64_t hash) const {
+    return (static_cast<unsigned __int128>(hash) * blocks_.size()) >> 64;
+}
+
+bool BloomBlockContainsScalar(const uint32_t *block, uint32_t hash) {
+    uint32_t missing = 0;
+    for (size_t i = 0; i < BlockedBloomFilter::kWords; ++i) {
+        missing |= ~block[i] & (uint32_t(1) << ((hash * BlockedBloomFilter::kSalts[i]) >> 27));
+    }
+    return missing == 0;
+}
+
+__attribute__((target("avx2")))
+bool BloomBlockContainsAvx2(const uint32_t *block, uint32_t hash) {
+    const __m256i salts =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(BlockedBloomFilter::kSalts));
+    __m256i shifts = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(hash), salts), 27);
+    __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), shifts);
+    // testc: every bit of mask is set in the block.
+    return _mm256_testc_si256(_mm256_load_si256(reinterpret_cast<const __m256i *>(block)), mask);
+}
+
+__attribute__((target("avx2")))
+bool BlockContainsAvx2(const int *block, int value) {
+    __m256i key = _mm256_set1_epi32(value);
+    auto lanes = reinterpret_cast<const __m256i *>(block);
+    __m256i equal = _mm256_or_si256(_mm256_cmpeq_epi32(_mm256_load_si256(lanes), key),
+                                    _mm256_cmpeq_epi32(_mm256_load_si256(lanes + 1), key));
+    return !_mm256_testz_si256(equal, equal);
+}
+
+__attribute__((target("avx512f")))
+bool BlockContainsAvx512(const int *block, int value) {
+    return _mm512_cmpeq_epi32_mask(_mm512_load_si512(block), _mm512_set1_epi32(value)) != 0;
+}
+
+bool CheckImageRoundTrip(std::ostream &out) {
+    const size_t kDataSize = 1 << 16;
+    // Small enough for BuildImage to need more than kMaxOpenPartitions
+    // partitions.
+    const size_t kMemoryBudget = 1 << 14;
+    std::mt19937 random_generator(7);
+    std::vector<int> data(kDataSize);
+    for (auto &value : data) {
+        value = static_cast<int>(random_generator());
+    }
+    std::sort(data.begin(), data.end());
+    data.erase(std::unique(data.begin(), data.end()), data.end());
+    std::vector<int> queries(2 * data.size());
+    for (auto &value : queries) {
+        value = random_generator() % 2 ? data[random_generator() % data.size()]
+                                       : static_cast<int>(random_generator());
+    }
 
-        for (size_t i = 0; i < hashTable_.size(); ++i) {
-            hashTable_[i].Initialize(baskets[i]);
+    using Table = FlatPerfectHashTable<int, MultiplyShiftHash, FillerSlots<int>>;
+    auto directory = std::filesystem::temp_directory_path();
+    auto base = (directory / ("fixed_set_check." + std::to_string(getpid()))).string();
+    const std::string saved_path = base + ".saved";
+    const std::string built_path = base + ".built";
+    Table in_memory;
+    in_memory.Initialize(data);
+    Table saved;
+    Table built;
+    size_t next = 0;
+    auto next_key = [&](int *key) {
+        if (next == data.size()) {
+            return false;
         }
+        *key = data[next++];
         return true;
+    };
+    bool ready = in_memory.Save(saved_path) && saved.Open(saved_path) &&
+                 built.BuildImage(next_key, built_path, kMemoryBudget);
+    // The mappings outlive the files.
+    std::remove(saved_path.c_str());
+    std::remove(built_path.c_str());
+    if (!ready) {
+        out << "Table images: cannot write or open an image in " << directory << "\n";
+        return false;
+    }
+    for (auto value : queries) {
+        bool expected = in_memory.Contains(value);
+        if (saved.Contains(value) != expected || built.Contains(value) != expected) {
+            out << "Table images: the images disagree with the table on " << value << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+template<typename HashTable, typename Key>
+double MeasureLookupNanoseconds(const HashTable &static_hash_table,
+                                const std::vector<Key> &queries, size_t *hits) {
+    auto start = std::chrono::steady_clock::now();
+    size_t found = 0;
+    for (auto value: queries) {
+        found += static_hash_table.Contains(value);
     }
+    auto finish = std::chrono::steady_clock::now();
+    *hits = found;
+    return std::chrono::duration<double, std::nano>(finish - start).count() / queries.size();
 }
 
+bool RunLookupBenchmark(std::ostream &out) {
+    const size_t kDataSize = 1 << 20;
+    const size_t kQueriesSize = 1 << 23;
+    std::mt19937 random_generator(42);
+    std::uniform_int_distribution<int> distribution(0, (1 << 30) - 1);
+    std::vector<int> data(kDataSize);
+    for (auto &value: data) {
+        value = distribution(random_generator);
+    }
+    std::sort(data.begin(), data.end());
+    data.erase(std::unique(data.begin(), data.end()), data.end());
+    std::vector<int> queries(kQueriesSize);
+    for (auto &value: queries) {
+        value = random_generator() % 2 ? data[random_generator() % data.size()]
+                                       : distribution(random_generator);
+    }
+
+    PerfectHashTable<int, Hash, FillerSlots<int>> virtual_table;
+    virtual_table.Initialize(data);
+    InlinePerfectHashTable<int, Hash, FillerSlots<int>> inline_table;
+    inline_table.Initialize(data);
+    FlatPerfectHashTable<int, Hash, FillerSlots<int>> flat_table;
+    flat_table.Initialize(data);
+    FlatPerfectHashTable<int, Hash, BitmapSlots<int>> bitmap_table;
+    bitmap_table.Initialize(data);
+    FlatPerfectHashTable<int, MultiplyShiftHash, FillerSlots<int>> division_free_table;
+    division_free_table.Initialize(data);
+    FlatPerfectHashTable<int, MultiplyShiftHash, FillerSlots<int>> prefiltered_table;
+    prefiltered_table.SetPrefilter(true);
+    prefiltered_table.Initialize(data);
+    // Mostly absent keys, where the prefilter pays off.
+    std::vector<int> miss_queries(kQueriesSize);
+    for (auto &value: miss_queries) {
+        value = random_generator() % 10 ? distribution(random_generator)
+                                        : data[random_generator() % data.size()];
+    }
+    MinimalPerfectHashTable<int, MultiplyShiftHash> minimal_table;
+    minimal_table.Initialize(data);
+    MinimalPerfectHashTable<int, MultiplyShiftHash, FingerprintSlots<int, uint8_t>>
+            fingerprint_table;
+    fingerprint_table.Initialize(data);
+    MinimalPerfectHashTable<int, MultiplyShiftHash, FingerprintSlots<int, uint16_t>>
+            wide_fingerprint_table;
+    wide_fingerprint_table.Initialize(data);
+    BBHashTable<int, MixHash> bbhash_table;
+    bbhash_table.Initialize(data);
+    BlockedHashTable<int, MultiplyShiftHash> blocked_table;
+    blocked_table.Initialize(data);
+    BinaryFuseFilter<int, MixHash> fuse_filter;
+    fuse_filter.Initialize(data);
+    // The same sets spread over 64 bits by the MixBits bijection.
+    std::vector<uint64_t> wide_data(data.size());
+    std::transform(data.begin(), data.end(), wide_data.begin(), MixBits);
+    std::vector<uint64_t> wide_queries(queries.size());
+    std::transform(queries.begin(), queries.end(), wide_queries.begin(), MixBits);
+    FlatPerfectHashTable<uint64_t, MultiplyShiftHash64, FillerSlots<uint64_t>> wide_table;
+    wide_table.Initialize(wide_data);
+    // And as decimal strings.
+    std::vector<std::string> string_data(data.size());
+    std::transform(data.begin(), data.end(), string_data.begin(),
+                   [](int value) { return std::to_string(value); });
+    std::vector<std::string> string_queries(queries.size());
+    std::transform(queries.begin(), queries.end(), string_queries.begin(),
+                   [](int value) { return std::to_string(value); });
+    StringFixedSet string_table;
+    string_table.Initialize(std::vector<std::string_view>(string_data.begin(), string_data.end()));
+
+    // Every exact engine must find as many keys as the virtual table; the
+    // fingerprint tables and the fuse filter may find more.
+    size_t exact_hits = 0;
+    auto agrees = [](const char *name, size_t hits, size_t expected) {
+        if (hits != expected) {
+            std::cerr << name << " disagrees with PerfectHashTable: " << hits << " and "
+                      << expected << " hits\n";
+            return false;
+        }
+        return true;
+    };
+    size_t hits;
+    double nanoseconds = MeasureLookupNanoseconds(virtual_table, queries, &hits);
+    out << "PerfectHashTable (virtual): " << nanoseconds << " ns/lookup, " << hits << " hits\n";
+    exact_hits = hits;
+    nanoseconds = MeasureLookupNanoseconds(inline_table, queries, &hits);
+    out << "InlinePerfectHashTable: " << nanoseconds << " ns/lookup, " << hits << " hits\n";
+    if (!agrees("InlinePerfectHashTable", hits, exact_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(flat_table, queries, &hits);
+    out << "FlatPerfectHashTable: " << nanoseconds << " ns/lookup, " << hits << " hits\n";
+    if (!agrees("FlatPerfectHashTable", hits, exact_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(bitmap_table, queries, &hits);
+    out << "FlatPerfectHashTable (BitmapSlots): " << nanoseconds << " ns/lookup, " << hits
+        << " hits\n";
+    if (!agrees("FlatPerfectHashTable (BitmapSlots)", hits, exact_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(division_free_table, queries, &hits);
+    out << "FlatPerfectHashTable (MultiplyShiftHash): " << nanoseconds << " ns/lookup, "
+        << hits << " hits\n";
+    if (!agrees("FlatPerfectHashTable (MultiplyShiftHash)", hits, exact_hits)) {
+        return false;
+    }
+    size_t exact_miss_hits;
+    MeasureLookupNanoseconds(virtual_table, miss_queries, &exact_miss_hits);
+    nanoseconds = MeasureLookupNanoseconds(division_free_table, miss_queries, &hits);
+    out << "FlatPerfectHashTable (MultiplyShiftHash), 90% misses: " << nanoseconds
+        << " ns/lookup, " << hits << " hits\n";
+    if (!agrees("FlatPerfectHashTable (MultiplyShiftHash)", hits, exact_miss_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(prefiltered_table, miss_queries, &hits);
+    out << "FlatPerfectHashTable (MultiplyShiftHash, prefilter), 90% misses: " << nanoseconds
+        << " ns/lookup, " << hits << " hits\n";
+    if (!agrees("FlatPerfectHashTable (MultiplyShiftHash, prefilter)", hits, exact_miss_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(minimal_table, queries, &hits);
+    out << "MinimalPerfectHashTable (MultiplyShiftHash): " << nanoseconds << " ns/lookup, "
+        << hits << " hits\n";
+    if (!agrees("MinimalPerfectHashTable", hits, exact_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(fingerprint_table, queries, &hits);
+    out << "MinimalPerfectHashTable (8-bit fingerprints): " << nanoseconds << " ns/lookup, "
+        << hits << " hits\n";
+    nanoseconds = MeasureLookupNanoseconds(wide_fingerprint_table, queries, &hits);
+    out << "MinimalPerfectHashTable (16-bit fingerprints): " << nanoseconds << " ns/lookup, "
+        << hits << " hits\n";
+    nanoseconds = MeasureLookupNanoseconds(bbhash_table, queries, &hits);
+    out << "BBHashTable (MixHash): " << nanoseconds << " ns/lookup, " << hits << " hits\n";
+    if (!agrees("BBHashTable", hits, exact_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(blocked_table, queries, &hits);
+    out << "BlockedHashTable (MultiplyShiftHash): " << nanoseconds << " ns/lookup, "
+        << hits << " hits\n";
+    if (!agrees("BlockedHashTable", hits, exact_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(fuse_filter, queries, &hits);
+    out << "BinaryFuseFilter (MixHash): " << nanoseconds << " ns/lookup, " << hits
+        << " hits\n";
+    nanoseconds = MeasureLookupNanoseconds(wide_table, wide_queries, &hits);
+    out << "FlatPerfectHashTable (uint64_t, MultiplyShiftHash64): " << nanoseconds
+        << " ns/lookup, " << hits << " hits\n";
+    if (!agrees("FlatPerfectHashTable (uint64_t)", hits, exact_hits)) {
+        return false;
+    }
+    nanoseconds = MeasureLookupNanoseconds(string_table, string_queries, &hits);
+    out << "StringFixedSet: " << nanoseconds << " ns/lookup, " << hits << " hits\n";
+    if (!agrees("StringFixedSet", hits, exact_hits)) {
+        return false;
+    }
+
+    // Each vector kernel must answer every query as the scalar one does.
+    std::vector<uint8_t> found(queries.size());
+    std::vector<uint8_t> scalar_found;
+    auto active_kernel = GetLookupKernel();
+    for (auto kernel : {LookupKernel::kScalar, LookupKernel::kAvx2, LookupKernel::kAvx512}) {
+        if (!IsLookupKernelSupported(kernel)) {
+            continue;
+        }
+        SetLookupKernel(kernel);
+        auto start = std::chrono::steady_clock::now();
+        division_free_table.ContainsBatch(queries, found);
+        auto finish = std::chrono::steady_clock::now();
+        nanoseconds =
+                std::chrono::duration<double, std::nano>(finish - start).count() / queries.size();
+        hits = std::count(found.begin(), found.end(), 1);
+        out << "FlatPerfectHashTable (MultiplyShiftHash) ContainsBatch, "
+            << GetLookupKernelName(kernel) << ": " << nanoseconds << " ns/lookup, " << hits
+            << " hits\n";
+        if (kernel == LookupKernel::kScalar) {
+            scalar_found = found;
+        } else if (found != scalar_found) {
+            auto mismatch = std::mismatch(found.begin(), found.end(), scalar_found.begin());
+            std::cerr << "The " << GetLookupKernelName(kernel)
+                      << " kernel disagrees with the scalar one on query "
+                      << queries[mismatch.first - found.begin()] << "\n";
+            SetLookupKernel(active_kernel);
+            return false;
+        }
+    }
+    SetLookupKernel(active_kernel);
+    if (!agrees("ContainsBatch", std::count(scalar_found.begin(), scalar_found.end(), 1),
+                exact_hits)) {
+        return false;
+    }
+    for (const auto *table : {&division_free_table, &prefiltered_table}) {
+        auto start = std::chrono::steady_clock::now();
+        table->ContainsBatch(miss_queries, found);
+        auto finish = std::chrono::steady_clock::now();
+        nanoseconds =
+                std::chrono::duration<double, std::nano>(finish - start).count() / queries.size();
+        hits = std::count(found.begin(), found.end(), 1);
+        out << "FlatPerfectHashTable (MultiplyShiftHash"
+            << (table == &prefiltered_table ? ", prefilter" : "")
+            << ") ContainsBatch, 90% misses: " << nanoseconds << " ns/lookup, " << hits
+            << " hits\n";
+        if (!agrees("ContainsBatch, 90% misses,", hits, exact_miss_hits)) {
+            return false;
+        }
+    }
+
+    const size_t kLookupsInFlight = 16;
+    auto measure_async = [&](const auto &table, const char *name) {
+        auto start = std::chrono::steady_clock::now();
+        AnswerBlock(table, std::span<const int>(queries), std::span<uint8_t>(found),
+                    kLookupsInFlight);
+        auto finish = std::chrono::steady_clock::now();
+        double nanoseconds =
+                std::chrono::duration<double, std::nano>(finish - start).count() / queries.size();
+        size_t hits = std::count(found.begin(), found.end(), 1);
+        out << name << " ContainsAsync, " << kLookupsInFlight << " in flight: " << nanoseconds
+            << " ns/lookup, " << hits << " hits\n";
+        return agrees(name, hits, exact_hits);
+    };
+    if (!measure_async(virtual_table, "PerfectHashTable (virtual)") ||
+        !measure_async(division_free_table, "FlatPerfectHashTable (MultiplyShiftHash)") ||
+        !measure_async(prefiltered_table, "FlatPerfectHashTable (MultiplyShiftHash, prefilter)")) {
+        return false;
+    }
+
+    // OperateQueries end to end, with the text answers going to /dev/null.
+    int null_descriptor = open("/dev/null", O_WRONLY);
+    size_t max_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    for (size_t threads = 1;; threads = std::min(2 * threads, max_threads)) {
+        ResultWriter writer(null_descriptor, false);
+        auto start = std::chrono::steady_clock::now();
+        OperateQueries(queries, division_free_table, writer, threads, 0);
+        auto finish = std::chrono::steady_clock::now();
+        nanoseconds =
+                std::chrono::duration<double, std::nano>(finish - start).count() / queries.size();
+        out << "OperateQueries (FlatPerfectHashTable, MultiplyShiftHash), " << threads
+            << " threads: " << nanoseconds << " ns/query\n";
+        if (threads == max_threads) {
+            break;
+        }
+    }
+    close(null_descriptor);
+    return true;
+}